@@ -23,6 +23,9 @@
  */
 
 #include "cgmanager.h"
+#include "probes.h"
+#include "stats.h"
+#include "trace.h"
 
 #include <gio/gio.h>
 
@@ -70,41 +73,37 @@ cgmanager_connect (GError **error)
   return connection;
 }
 
+static GDBusConnection *cgmanager_connection;
+static GThread *cgmanager_setup_thread;
+static gboolean cgmanager_initialised;
+
+static GMutex cgmanager_moved_lock;
+static GCond cgmanager_moved_cond;
+static gboolean cgmanager_moved;
+
 static gboolean
-cgmanager_call (const gchar         *method_name,
-                GVariant            *parameters,
-                const GVariantType  *reply_type,
-                GVariant           **reply)
+cgmanager_call_on (GDBusConnection     *connection,
+                   const gchar         *method_name,
+                   GVariant            *parameters,
+                   const GVariantType  *reply_type,
+                   GVariant           **reply)
 {
-  static GDBusConnection *connection;
-  static gboolean initialised;
   GVariant *my_reply = NULL;
   GError *error = NULL;
+  gint64 start;
 
-  /* Use a separate bool to prevent repeated attempts to connect to a
-   * defunct cgmanager...
-   */
-  if (!initialised)
+  if (!connection)
     {
-      GError *error = NULL;
-
-      connection = cgmanager_connect (&error);
-
-      if (!connection)
-        {
-          g_warning ("Could not connect to cgmanager: %s", error->message);
-          g_error_free (error);
-        }
-
-      initialised = TRUE;
+      g_variant_unref (g_variant_ref_sink (parameters));
+      return FALSE;
     }
 
-  if (!connection)
-    return FALSE;
-
   if (!reply)
     reply = &my_reply;
 
+  start = g_get_monotonic_time ();
+  SHIM_PROBE1 (cgmanager_call_entry, method_name);
+
   /* We do this sync because we need to ensure that the calls finish
    * before we return to _our_ caller saying that this is done.
    */
@@ -113,6 +112,9 @@ cgmanager_call (const gchar         *method_name,
                                         parameters, reply_type, G_DBUS_CALL_FLAGS_NONE,
                                         -1, NULL, &error);
 
+  stats_record_backend (method_name, *reply == NULL, g_get_monotonic_time () - start);
+  SHIM_PROBE3 (cgmanager_call_return, method_name, *reply != NULL, g_get_monotonic_time () - start);
+
   if (!*reply)
     {
       if (reply_type)
@@ -129,7 +131,105 @@ cgmanager_call (const gchar         *method_name,
   return TRUE;
 }
 
-void
+static void
+cgmanager_move_self (GDBusConnection *connection)
+{
+  if (connection)
+    cgmanager_call_on (connection, "MovePidAbs", g_variant_new ("(ssi)", "all", "/", getpid ()), G_VARIANT_TYPE_UNIT, NULL);
+
+  g_mutex_lock (&cgmanager_moved_lock);
+  cgmanager_moved = TRUE;
+  g_cond_broadcast (&cgmanager_moved_cond);
+  g_mutex_unlock (&cgmanager_moved_lock);
+}
+
+static void
+cgmanager_install_release_agent (GDBusConnection *connection)
+{
+  GVariant *reply;
+  gchar *str;
+
+  int need_agent = 1;
+  if (cgmanager_call_on (connection, "GetValue", g_variant_new ("(sss)", "systemd", "/", "release_agent"), G_VARIANT_TYPE ("(s)"), &reply))
+  {
+          g_variant_get(reply, "(s)", &str);
+          g_variant_unref(reply);
+          need_agent = strlen(str) < 1;
+          g_free(str);
+  }
+
+  if (!need_agent)
+          return;
+
+  /* install our systemd cgroup release handler */
+  g_debug ("Installing cgroup release handler " LIBEXECDIR "/systemd-shim-cgroup-release-agent");
+  cgmanager_call_on (connection, "SetValue",
+                     g_variant_new ("(ssss)", "systemd", "/", "release_agent", LIBEXECDIR "/systemd-shim-cgroup-release-agent"),
+                     G_VARIANT_TYPE_UNIT,
+                     NULL);
+}
+
+static gpointer
+cgmanager_setup (gpointer user_data)
+{
+  GError *error = NULL;
+  GDBusConnection *connection;
+
+  connection = cgmanager_connect (&error);
+
+  /* Whatever we spawn inherits our cgroup, so this has to be done
+   * before we spawn anything: see cgmanager_wait_for_move().
+   */
+  cgmanager_move_self (connection);
+
+  if (connection)
+    cgmanager_install_release_agent (connection);
+  else
+    {
+      g_warning ("Could not connect to cgmanager: %s", error->message);
+      g_error_free (error);
+    }
+
+  return connection;
+}
+
+static GDBusConnection *
+cgmanager_get_connection (void)
+{
+  /* Use a separate bool to prevent repeated attempts to connect to a
+   * defunct cgmanager...
+   */
+  if (!cgmanager_initialised)
+    {
+      if (cgmanager_setup_thread)
+        cgmanager_connection = g_thread_join (cgmanager_setup_thread);
+      else
+        cgmanager_connection = cgmanager_setup (NULL);
+
+      cgmanager_setup_thread = NULL;
+      cgmanager_initialised = TRUE;
+    }
+
+  return cgmanager_connection;
+}
+
+static gboolean
+cgmanager_call (const gchar         *method_name,
+                GVariant            *parameters,
+                const GVariantType  *reply_type,
+                GVariant           **reply)
+{
+  gboolean success;
+  gint64 start;
+
+  start = g_get_monotonic_time ();
+  success = cgmanager_call_on (cgmanager_get_connection (), method_name, parameters, reply_type, reply);
+  trace_add_time (TRACE_PHASE_BACKEND, g_get_monotonic_time () - start);
+
+  return success;
+}
+
+gboolean
 cgmanager_create (const gchar *path,
                   gint         uid,
                   const guint *pids,
@@ -140,7 +240,10 @@ cgmanager_create (const gchar *path,
   if (path[0] == '/')
     path++;
 
-  cgmanager_call ("Create", g_variant_new ("(ss)", "all", path), G_VARIANT_TYPE ("(i)"), NULL);
+  SHIM_PROBE3 (cgmanager_create, path, uid, n_pids);
+
+  if (!cgmanager_call ("Create", g_variant_new ("(ss)", "all", path), G_VARIANT_TYPE ("(i)"), NULL))
+    return FALSE;
 
   if (uid != -1)
     cgmanager_call ("Chown", g_variant_new ("(ssii)", "all", path, uid, -1), G_VARIANT_TYPE_UNIT, NULL);
@@ -149,6 +252,8 @@ cgmanager_create (const gchar *path,
     cgmanager_call ("MovePid", g_variant_new ("(ssi)", "all", path, pids[i]), G_VARIANT_TYPE_UNIT, NULL);
 
   cgmanager_call ("SetValue", g_variant_new ("(ssss)", "systemd", path, "notify_on_release", "1"), G_VARIANT_TYPE_UNIT, NULL);
+
+  return TRUE;
 }
 
 gboolean
@@ -161,31 +266,32 @@ cgmanager_remove (const gchar *path)
 }
 
 void
-cgmanager_move_self (void)
+cgmanager_init (void)
 {
-  GVariant *reply;
-  gchar *str;
-
-  cgmanager_call ("MovePidAbs", g_variant_new ("(ssi)", "all", "/", getpid ()), G_VARIANT_TYPE_UNIT, NULL);
-
-  int need_agent = 1;
-  if (cgmanager_call ("GetValue", g_variant_new ("(sss)", "systemd", "/", "release_agent"), G_VARIANT_TYPE ("(s)"), &reply))
-  {
-          g_variant_get(reply, "(s)", &str);
-          g_variant_unref(reply);
-          need_agent = strlen(str) < 1;
-          g_free(str);
-  }
+  /* Connecting to cgmanager, moving ourselves to the root cgroup and
+   * checking the release agent takes a handful of round trips.  None of
+   * that is needed to answer power or NTP requests, so do it in a
+   * thread and only wait for it when we first need cgmanager.
+   */
+  if (!cgmanager_initialised && !cgmanager_setup_thread)
+    cgmanager_setup_thread = g_thread_new ("cgmanager-setup", cgmanager_setup, NULL);
+}
 
-  if (!need_agent)
-          return;
+/* Processes we spawn stay in whichever cgroup we are in at the time,
+ * so the setup thread has to have moved us to the root cgroup before
+ * we serve any request that might spawn something.  Only the move is
+ * waited for: the release agent check carries on in the background.
+ */
+void
+cgmanager_wait_for_move (void)
+{
+  if (cgmanager_initialised || !cgmanager_setup_thread)
+    return;
 
-  /* install our systemd cgroup release handler */
-  g_debug ("Installing cgroup release handler " LIBEXECDIR "/systemd-shim-cgroup-release-agent");
-  cgmanager_call ("SetValue",
-                  g_variant_new ("(ssss)", "systemd", "/", "release_agent", LIBEXECDIR "/systemd-shim-cgroup-release-agent"),
-                  G_VARIANT_TYPE_UNIT,
-                  NULL);
+  g_mutex_lock (&cgmanager_moved_lock);
+  while (!cgmanager_moved)
+    g_cond_wait (&cgmanager_moved_cond, &cgmanager_moved_lock);
+  g_mutex_unlock (&cgmanager_moved_lock);
 }
 
 void
@@ -202,14 +308,34 @@ cgmanager_kill (const gchar *path)
   if (cgmanager_call ("GetTasksRecursive", g_variant_new ("(ss)", "all", path), G_VARIANT_TYPE ("(ai)"), &reply))
     {
       GVariantIter *iter;
+      guint n_pids = 0;
       guint32 pid;
 
       g_variant_get (reply, "(ai)", &iter);
 
       while (g_variant_iter_next (iter, "i", &pid))
-        kill (pid, SIGKILL);
+        {
+          kill (pid, SIGKILL);
+          n_pids++;
+        }
+
+      SHIM_PROBE2 (cgmanager_kill, path, n_pids);
 
       g_variant_iter_free (iter);
       g_variant_unref (reply);
     }
 }
+
+gboolean
+cgmanager_freeze (const gchar *path,
+                  gboolean     frozen)
+{
+  if (path[0] == '/')
+    path++;
+
+  SHIM_PROBE2 (cgmanager_freeze, path, frozen);
+
+  return cgmanager_call ("SetValue", g_variant_new ("(ssss)", "freezer", path, "freezer.state",
+                                                    frozen ? "FROZEN" : "THAWED"),
+                         G_VARIANT_TYPE_UNIT, NULL);
+}
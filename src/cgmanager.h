@@ -25,17 +25,22 @@
 
 #include <glib.h>
 
-void cgmanager_create (const gchar *path,
-                       gint         uid,
-                       const guint *pids,
-                       guint        n_pids);
+gboolean cgmanager_create (const gchar *path,
+                           gint         uid,
+                           const guint *pids,
+                           guint        n_pids);
 
 void cgmanager_prune (const gchar *path);
 
 gboolean cgmanager_remove (const gchar *path);
 
-void cgmanager_move_self (void);
+void cgmanager_init (void);
+
+void cgmanager_wait_for_move (void);
 
 void cgmanager_kill (const gchar *scope);
 
+gboolean cgmanager_freeze (const gchar *path,
+                           gboolean     frozen);
+
 #endif /* _cgmanager_h_ */
@@ -23,6 +23,8 @@
 #include <glib.h>
 #include <gio/gio.h>
 
+#include "private-server.h"
+
 #include <unistd.h>
 #include <stdio.h>
 
@@ -32,18 +34,31 @@ int
 main (int argc, char** argv)
 {
   gchar* unit_name;
+  const gchar *destination;
   GDBusConnection *connection;
   GVariant *reply = NULL;
   GError *error = NULL;
 
   g_assert(argc == 2);
   unit_name = g_path_get_basename (argv[1]);
-  connection = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &error);
+
+  /* Talk to systemd-shim directly if it is already running, otherwise
+   * go through the bus so that it gets activated.
+   */
+  destination = NULL;
+  connection = g_dbus_connection_new_for_address_sync (PRIVATE_SERVER_ADDRESS,
+                                                       G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT,
+                                                       NULL, NULL, NULL);
   if (connection == NULL)
-    g_error ("Cannot connect to system D-BUS: %s", error->message);
+    {
+      destination = "org.freedesktop.systemd1";
+      connection = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &error);
+      if (connection == NULL)
+        g_error ("Cannot connect to system D-BUS: %s", error->message);
+    }
   g_debug ("sending StopUnit(%s) to systemd-shim", unit_name);
   reply = g_dbus_connection_call_sync (connection,
-                                       "org.freedesktop.systemd1",
+                                       destination,
                                        "/org/freedesktop/systemd1",
                                        "org.freedesktop.systemd1.Manager",
                                        "StopUnit",
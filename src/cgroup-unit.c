@@ -37,7 +37,6 @@ static GType cgroup_unit_get_type (void);
 typedef struct
 {
   Unit parent_instance;
-  gchar *name;
 } CGroupUnit;
 
 G_DEFINE_TYPE (CGroupUnit, cgroup_unit, UNIT_TYPE)
@@ -81,21 +80,93 @@ cgroup_unit_get_path_and_uid (const gchar *slice,
   return g_string_free (path, FALSE);
 }
 
+static const gchar *
+cgroup_unit_get_running_state (Unit *unit)
+{
+  return g_str_has_suffix (unit->name, ".scope") ? "running" : "active";
+}
+
+static void
+cgroup_unit_started (Unit        *unit,
+                     const gchar *path,
+                     gboolean     success)
+{
+  if (success)
+    {
+      gchar *timestamp;
+
+      timestamp = g_strdup_printf ("%" G_GINT64_FORMAT, g_get_real_time ());
+
+      state_freeze ();
+      state_set_string (unit->name, "path", path);
+      state_set_string (unit->name, "timestamp", timestamp);
+      state_thaw ();
+
+      g_free (timestamp);
+
+      unit_set_active_state (unit, UNIT_ACTIVE, cgroup_unit_get_running_state (unit));
+    }
+  else
+    unit_set_active_state (unit, UNIT_FAILED, "failed");
+}
+
 static void
+cgroup_unit_load (Unit *unit)
+{
+  gchar *path;
+
+  path = state_get_string (unit->name, "path");
+
+  if (path)
+    {
+      gchar *timestamp;
+
+      unit->active_state = UNIT_ACTIVE;
+      unit->sub_state = cgroup_unit_get_running_state (unit);
+
+      timestamp = state_get_string (unit->name, "timestamp");
+      if (timestamp)
+        unit->active_enter_timestamp = g_ascii_strtoull (timestamp, NULL, 10);
+      unit->inactive_exit_timestamp = unit->active_enter_timestamp;
+      unit->state_change_timestamp = unit->active_enter_timestamp;
+      g_free (timestamp);
+    }
+
+  g_free (path);
+}
+
+static gchar *
+cgroup_unit_get_control_group (Unit *unit)
+{
+  gchar *path;
+  gchar *result;
+
+  path = state_get_string (unit->name, "path");
+
+  if (!path)
+    return NULL;
+
+  result = g_strconcat ("/", path, NULL);
+  g_free (path);
+
+  return result;
+}
+
+static gboolean
 cgroup_unit_start_transient (Unit     *unit,
                              GVariant *properties)
 {
-  CGroupUnit *cg_unit = (CGroupUnit *) unit;
   GVariantIter iter;
   const gchar *key;
   GVariant *value;
+  gboolean valid;
   gchar *slice;
   GArray *pids;
 
-  if (!g_str_has_suffix (cg_unit->name, ".scope"))
+  if (!g_str_has_suffix (unit->name, ".scope"))
     {
-      g_warning ("%s: Can only StartTransient for scopes", cg_unit->name);
-      return;
+      g_warning ("%s: Can only StartTransient for scopes", unit->name);
+      return FALSE;
     }
 
   pids = g_array_new (TRUE, FALSE, sizeof (guint));
@@ -120,78 +191,164 @@ cgroup_unit_start_transient (Unit     *unit,
         }
     }
 
-  if (slice && g_str_has_suffix (slice, ".slice"))
+  valid = slice && g_str_has_suffix (slice, ".slice");
+
+  if (valid)
     {
       gchar *path;
       gint uid;
 
-      path = cgroup_unit_get_path_and_uid (slice, cg_unit->name, &uid);
-      cgmanager_create (path, uid, (const guint *) pids->data, pids->len);
-      state_set_string (cg_unit->name, "path", path);
+      path = cgroup_unit_get_path_and_uid (slice, unit->name, &uid);
+      cgroup_unit_started (unit, path, cgmanager_create (path, uid, (const guint *) pids->data, pids->len));
       g_free (path);
     }
   else
-    g_warning ("%s: StartTransient failed: requires 'Slice' property ending with '.slice'", cg_unit->name);
+    {
+      g_warning ("%s: StartTransient failed: requires 'Slice' property ending with '.slice'", unit->name);
+      unit_set_active_state (unit, UNIT_FAILED, "failed");
+    }
 
   g_array_free (pids, TRUE);
+  g_free (slice);
+
+  return valid;
 }
 
 static void
 cgroup_unit_start (Unit *unit)
 {
-  CGroupUnit *cg_unit = (CGroupUnit *) unit;
   gchar *path;
   gint uid;
 
-  if (!g_str_has_suffix (cg_unit->name, ".slice"))
+  if (!g_str_has_suffix (unit->name, ".slice"))
     {
-      g_warning ("%s: Can only Start for slices", cg_unit->name);
+      g_warning ("%s: Can only Start for slices", unit->name);
       return;
     }
 
-  path = cgroup_unit_get_path_and_uid (cg_unit->name, NULL, &uid);
-  cgmanager_create (path, uid, NULL, 0);
-  state_set_string (cg_unit->name, "path", path);
+  path = cgroup_unit_get_path_and_uid (unit->name, NULL, &uid);
+  cgroup_unit_started (unit, path, cgmanager_create (path, uid, NULL, 0));
   g_free (path);
 }
 
+/* Frozen tasks can't die, so killing and removing 'path' would just
+ * keep failing if it is, or is inside, a user slice that we froze for
+ * suspend: thaw that first.
+ */
 static void
-cgroup_unit_stop (Unit *unit)
+cgroup_unit_thaw_for_stop (const gchar *path)
 {
-  CGroupUnit *cg_unit = (CGroupUnit *) unit;
-  gboolean successful;
+  gchar **units;
+  guint i;
+
+  units = state_list_units ();
+
+  for (i = 0; units[i]; i++)
+    {
+      gchar *slice_path;
+      gchar *frozen;
+
+      frozen = state_get_string (units[i], "frozen");
+      slice_path = frozen ? state_get_string (units[i], "path") : NULL;
+
+      if (slice_path && g_str_has_prefix (path, slice_path) &&
+          (path[strlen (slice_path)] == '\0' || path[strlen (slice_path)] == '/'))
+        {
+          cgmanager_freeze (slice_path, FALSE);
+          state_remove_key (units[i], "frozen");
+        }
+
+      g_free (slice_path);
+      g_free (frozen);
+    }
+
+  g_strfreev (units);
+}
+
+/* Kills and removes the cgroups of all of 'units', in passes over the
+ * whole batch: each cgroup gets as long as it takes to kill the others
+ * for its processes to exit before we try to remove it, and one cgroup
+ * that takes a few tries doesn't hold up the rest.
+ */
+static void
+cgroup_unit_stop_many (Unit  **units,
+                       guint   n_units)
+{
+  GPtrArray *remaining;
+  GPtrArray *paths;
   gint tries;
-  gchar *path;
+  guint i;
 
-  path = state_get_string (cg_unit->name, "path");
+  remaining = g_ptr_array_new ();
+  paths = g_ptr_array_new_with_free_func (g_free);
 
-  if (!path)
+  for (i = 0; i < n_units; i++)
     {
-      g_warning ("can't Stop: cgroup unit not previously started");
-      return;
+      gchar *path;
+
+      path = state_get_string (units[i]->name, "path");
+
+      if (!path)
+        {
+          g_warning ("%s: can't Stop: cgroup unit not previously started", units[i]->name);
+          continue;
+        }
+
+      cgroup_unit_thaw_for_stop (path);
+
+      unit_set_active_state (units[i], UNIT_DEACTIVATING, "stop-sigkill");
+      g_ptr_array_add (remaining, units[i]);
+      g_ptr_array_add (paths, path);
     }
 
-  tries = 5;
+  state_freeze ();
+
+  tries = 6;
 
-  do
+  while (remaining->len && tries--)
     {
-      cgmanager_kill (path);
-      successful = cgmanager_remove (path);
+      for (i = 0; i < remaining->len; i++)
+        cgmanager_kill (g_ptr_array_index (paths, i));
+
+      /* Iterate backwards so that removing doesn't skip anything */
+      for (i = remaining->len; i-- > 0; )
+        if (cgmanager_remove (g_ptr_array_index (paths, i)))
+          {
+            Unit *unit = g_ptr_array_index (remaining, i);
+
+            state_remove_unit (unit->name);
+            unit_set_active_state (unit, UNIT_INACTIVE, "dead");
+            g_ptr_array_remove_index (remaining, i);
+            g_ptr_array_remove_index (paths, i);
+          }
     }
-  while (tries-- && !successful);
 
-  state_remove_unit (cg_unit->name);
+  for (i = 0; i < remaining->len; i++)
+    {
+      Unit *unit = g_ptr_array_index (remaining, i);
 
-  g_free (path);
+      state_remove_unit (unit->name);
+      unit_set_active_state (unit, UNIT_FAILED, "failed");
+    }
+
+  state_thaw ();
+
+  g_ptr_array_unref (remaining);
+  g_ptr_array_unref (paths);
+}
+
+static void
+cgroup_unit_stop (Unit *unit)
+{
+  cgroup_unit_stop_many (&unit, 1);
 }
 
 static void
 cgroup_unit_abandon (Unit *unit)
 {
-  CGroupUnit *cg_unit = (CGroupUnit *) unit;
   gchar *path;
 
-  path = state_get_string (cg_unit->name, "path");
+  path = state_get_string (unit->name, "path");
 
   if (!path)
     {
@@ -201,7 +358,12 @@ cgroup_unit_abandon (Unit *unit)
 
   cgmanager_prune (path);
 
-  state_remove_unit (cg_unit->name);
+  state_remove_unit (unit->name);
+
+  /* We no longer track the cgroup once it has been abandoned, so as
+   * far as anyone asking us is concerned, the unit is gone.
+   */
+  unit_set_active_state (unit, UNIT_INACTIVE, "dead");
 
   g_free (path);
 }
@@ -209,19 +371,65 @@ cgroup_unit_abandon (Unit *unit)
 static const gchar *
 cgroup_unit_get_state (Unit *unit)
 {
-  CGroupUnit *gc = (CGroupUnit *)unit;
-  return gc->name;
+  return "transient";
+}
+
+/* Freezing the user slices before suspend leaves the kernel's freezer
+ * little to do, and keeps user processes from competing with system
+ * services on resume until we thaw them.  Which slices we froze is kept
+ * in the state file, so that they get thawed even if we go away in the
+ * meantime.
+ */
+void
+cgroup_units_freeze_user_slices (gboolean frozen)
+{
+  gchar **units;
+  guint i;
+
+  units = state_list_units ();
+
+  state_freeze ();
+
+  for (i = 0; units[i]; i++)
+    {
+      gchar *path;
+      gchar *was_frozen;
+
+      if (!g_str_has_prefix (units[i], "user-") || !g_str_has_suffix (units[i], ".slice"))
+        continue;
+
+      path = state_get_string (units[i], "path");
+      was_frozen = state_get_string (units[i], "frozen");
+
+      if (path && frozen && !was_frozen)
+        {
+          if (cgmanager_freeze (path, TRUE))
+            state_set_string (units[i], "frozen", "true");
+        }
+      else if (path && !frozen && was_frozen)
+        {
+          cgmanager_freeze (path, FALSE);
+          state_remove_key (units[i], "frozen");
+        }
+
+      g_free (was_frozen);
+      g_free (path);
+    }
+
+  state_thaw ();
+
+  g_strfreev (units);
 }
 
 Unit *
 cgroup_unit_new (const gchar *name)
 {
-  CGroupUnit *unit;
+  Unit *unit;
 
   unit = g_object_new (cgroup_unit_get_type (), NULL);
   unit->name = g_strdup (name);
 
-  return (Unit *) unit;
+  return unit;
 }
 
 static void
@@ -232,9 +440,13 @@ cgroup_unit_init (CGroupUnit *unit)
 static void
 cgroup_unit_class_init (UnitClass *class)
 {
+  class->transient = TRUE;
+  class->load = cgroup_unit_load;
+  class->get_control_group = cgroup_unit_get_control_group;
   class->start_transient = cgroup_unit_start_transient;
   class->start = cgroup_unit_start;
   class->stop = cgroup_unit_stop;
+  class->stop_many = cgroup_unit_stop_many;
   class->abandon = cgroup_unit_abandon;
   class->get_state = cgroup_unit_get_state;
 }
@@ -0,0 +1,285 @@
+/*
+ * Copyright © 2014 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#include "kexec.h"
+#include "probes.h"
+#include "settings.h"
+
+#include <glib/gstdio.h>
+
+#define KEXEC_BINARY          "/sbin/kexec"
+#define KEXEC_LOADED_FILENAME "/sys/kernel/kexec_loaded"
+#define KEXEC_STATE_FILENAME  "/run/systemd-shim-kexec"
+
+/* Loading a kernel with 'kexec -l' reads and relocates the whole image
+ * and initrd, which takes a while, so we do it ahead of time (in the
+ * background) and the reboot itself only has to jump into it.  The jump
+ * is done by the kexec init script at the very end of the reboot
+ * runlevel, after a clean shutdown, whenever a kernel is loaded.
+ *
+ * We remember the mtime of the kernel we loaded, so that a kernel that
+ * has been updated since then gets loaded again.
+ */
+
+static GQueue kexec_pending;
+
+static gchar *
+kexec_get_kernel (void)
+{
+  return settings_get_string ("Kexec", "Kernel", "/vmlinuz");
+}
+
+static gint64
+kexec_get_kernel_mtime (const gchar *kernel)
+{
+  GStatBuf buf;
+
+  if (g_stat (kernel, &buf) != 0)
+    return -1;
+
+  return buf.st_mtime;
+}
+
+gboolean
+kexec_is_loaded (void)
+{
+  gchar *contents;
+  gboolean loaded;
+
+  if (!g_file_get_contents (KEXEC_LOADED_FILENAME, &contents, NULL, NULL))
+    return FALSE;
+
+  loaded = g_str_has_prefix (contents, "1");
+  g_free (contents);
+
+  return loaded;
+}
+
+/* Whether a kernel is loaded and it is still the one configured */
+static gboolean
+kexec_is_current (void)
+{
+  gboolean loaded;
+  gchar *contents;
+
+  loaded = kexec_is_loaded ();
+
+  /* If we didn't load it then somebody else did on purpose */
+  if (loaded && g_file_get_contents (KEXEC_STATE_FILENAME, &contents, NULL, NULL))
+    {
+      gchar *kernel;
+
+      kernel = kexec_get_kernel ();
+      loaded = g_ascii_strtoll (contents, NULL, 10) == kexec_get_kernel_mtime (kernel);
+      g_free (contents);
+      g_free (kernel);
+    }
+
+  return loaded;
+}
+
+static void
+kexec_return_pending (gboolean  success,
+                      GError   *error)
+{
+  GTask *task;
+
+  while ((task = g_queue_pop_head (&kexec_pending)))
+    {
+      if (success)
+        g_task_return_boolean (task, TRUE);
+      else
+        g_task_return_error (task, g_error_copy (error));
+
+      g_object_unref (task);
+    }
+}
+
+static void
+kexec_loaded (GPid     pid,
+              gint     status,
+              gpointer user_data)
+{
+  gint64 mtime = *(gint64 *) user_data;
+  GError *error = NULL;
+  gboolean success;
+
+  success = g_spawn_check_exit_status (status, &error);
+  SHIM_PROBE1 (kexec_loaded, success);
+  g_spawn_close_pid (pid);
+
+  if (success)
+    {
+      gchar *contents;
+
+      contents = g_strdup_printf ("%" G_GINT64_FORMAT "\n", mtime);
+      g_file_set_contents (KEXEC_STATE_FILENAME, contents, -1, NULL);
+      g_free (contents);
+
+      g_debug ("kexec kernel loaded");
+    }
+  else
+    g_warning ("Unable to load kexec kernel: %s", error->message);
+
+  kexec_return_pending (success, error);
+
+  if (error)
+    g_error_free (error);
+  g_free (user_data);
+}
+
+/* Loads the configured kernel, if it isn't already.  Requests that come
+ * in while a load is under way wait for that one.
+ */
+void
+kexec_load_async (GAsyncReadyCallback callback,
+                  gpointer            user_data)
+{
+  GError *error = NULL;
+  GPtrArray *argv;
+  gchar *kernel;
+  gchar *initrd;
+  gchar *cmdline;
+  gint64 *mtime;
+  GPid pid;
+  gboolean in_progress;
+
+  in_progress = !g_queue_is_empty (&kexec_pending);
+  g_queue_push_tail (&kexec_pending, g_task_new (NULL, NULL, callback, user_data));
+  if (in_progress)
+    return;
+
+  if (kexec_is_current ())
+    {
+      kexec_return_pending (TRUE, NULL);
+      return;
+    }
+
+  kernel = kexec_get_kernel ();
+  initrd = settings_get_string ("Kexec", "Initrd", "/initrd.img");
+  cmdline = settings_get_string ("Kexec", "CommandLine", NULL);
+
+  mtime = g_new (gint64, 1);
+  *mtime = kexec_get_kernel_mtime (kernel);
+
+  argv = g_ptr_array_new_with_free_func (g_free);
+  g_ptr_array_add (argv, g_strdup (KEXEC_BINARY));
+  g_ptr_array_add (argv, g_strdup ("-l"));
+  g_ptr_array_add (argv, g_strdup (kernel));
+  if (initrd[0] && g_file_test (initrd, G_FILE_TEST_EXISTS))
+    g_ptr_array_add (argv, g_strconcat ("--initrd=", initrd, NULL));
+  if (cmdline)
+    g_ptr_array_add (argv, g_strconcat ("--append=", cmdline, NULL));
+  else
+    g_ptr_array_add (argv, g_strdup ("--reuse-cmdline"));
+  g_ptr_array_add (argv, NULL);
+
+  g_debug ("Loading kexec kernel %s", kernel);
+  SHIM_PROBE1 (kexec_load, kernel);
+
+  if (g_spawn_async (NULL, (gchar **) argv->pdata, NULL, G_SPAWN_DO_NOT_REAP_CHILD, NULL, NULL, &pid, &error))
+    g_child_watch_add (pid, kexec_loaded, mtime);
+  else
+    {
+      g_warning ("Unable to run " KEXEC_BINARY ": %s", error->message);
+      kexec_return_pending (FALSE, error);
+      g_error_free (error);
+      g_free (mtime);
+    }
+
+  g_ptr_array_unref (argv);
+  g_free (cmdline);
+  g_free (initrd);
+  g_free (kernel);
+}
+
+gboolean
+kexec_load_finish (GAsyncResult  *result,
+                   GError       **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, NULL), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+static void
+kexec_unloaded (GPid     pid,
+                gint     status,
+                gpointer user_data)
+{
+  GTask *task = user_data;
+  GError *error = NULL;
+
+  g_spawn_close_pid (pid);
+
+  if (g_spawn_check_exit_status (status, &error))
+    g_task_return_boolean (task, TRUE);
+  else
+    {
+      g_warning ("Unable to unload kexec kernel: %s", error->message);
+      g_task_return_error (task, error);
+    }
+
+  g_object_unref (task);
+}
+
+/* Makes sure that the next reboot goes through the firmware, if it was
+ * us that staged a kernel.  One that the admin loaded by hand is left
+ * alone.
+ */
+void
+kexec_unload_async (GAsyncReadyCallback callback,
+                    gpointer            user_data)
+{
+  gchar *argv[] = { (gchar *) KEXEC_BINARY, (gchar *) "-u", NULL };
+  GError *error = NULL;
+  GTask *task;
+  GPid pid;
+
+  task = g_task_new (NULL, NULL, callback, user_data);
+
+  if (!g_file_test (KEXEC_STATE_FILENAME, G_FILE_TEST_EXISTS) || !kexec_is_loaded ())
+    {
+      g_task_return_boolean (task, TRUE);
+      g_object_unref (task);
+      return;
+    }
+
+  g_unlink (KEXEC_STATE_FILENAME);
+  SHIM_PROBE (kexec_unload);
+
+  if (g_spawn_async (NULL, argv, NULL, G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_STDOUT_TO_DEV_NULL |
+                     G_SPAWN_STDERR_TO_DEV_NULL, NULL, NULL, &pid, &error))
+    g_child_watch_add (pid, kexec_unloaded, task);
+  else
+    {
+      g_warning ("Unable to unload kexec kernel: %s", error->message);
+      g_task_return_error (task, error);
+      g_object_unref (task);
+    }
+}
+
+gboolean
+kexec_unload_finish (GAsyncResult  *result,
+                     GError       **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, NULL), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright © 2014 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#ifndef _kexec_h_
+#define _kexec_h_
+
+#include <gio/gio.h>
+
+gboolean kexec_is_loaded (void);
+
+void kexec_load_async (GAsyncReadyCallback callback,
+                       gpointer            user_data);
+
+gboolean kexec_load_finish (GAsyncResult  *result,
+                            GError       **error);
+
+void kexec_unload_async (GAsyncReadyCallback callback,
+                         gpointer            user_data);
+
+gboolean kexec_unload_finish (GAsyncResult  *result,
+                              GError       **error);
+
+#endif /* _kexec_h_ */
@@ -22,51 +22,190 @@
 #include "unit.h"
 
 #include <stdio.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/timex.h>
 
-#define NTPDATE_ENABLED   "/etc/network/if-up.d/ntpdate"
-#define NTPDATE_DISABLED  "/etc/network/if-up.d/ntpdate.disabled"
+#define NTPDATE_DIRECTORY "/etc/network/if-up.d"
+#define NTPDATE_ENABLED   NTPDATE_DIRECTORY "/ntpdate"
+#define NTPDATE_DISABLED  NTPDATE_DIRECTORY "/ntpdate.disabled"
 #define NTPDATE_AVAILABLE "/usr/sbin/ntpdate-debian"
 #define NTPD_AVAILABLE    "/usr/sbin/ntpd"
+#define NTPD_PIDFILE      "/var/run/ntpd.pid"
+
+/* timedated and the settings UIs ask about NTP a lot, so we remember
+ * what we found out and only look again when inotify tells us that
+ * something changed: the if-up.d directory for ntpdate, or the pidfile
+ * that the ntp init script keeps for ntpd.  Whether the pid in there is
+ * still running is checked on every query, but that is a kill(0)
+ * rather than the fork and exec of 'service ntp status'.
+ *
+ * Whether the binaries are installed is only checked once: we are
+ * restarted often enough for that not to go stale.
+ */
+typedef struct
+{
+  gboolean can_use_ntpdate;
+  gboolean can_use_ntpd;
+
+  gboolean using_ntpdate_valid;
+  gboolean using_ntpdate;
+
+  gboolean ntpd_pid_valid;
+  GPid ntpd_pid;
+
+  GFileMonitor *ntpdate_monitor;
+  GFileMonitor *ntpd_monitor;
+} NtpCache;
+
+static NtpCache *ntp_cache;
+
+static void
+ntp_cache_ntpdate_changed (GFileMonitor      *monitor,
+                           GFile             *file,
+                           GFile             *other_file,
+                           GFileMonitorEvent  event_type,
+                           gpointer           user_data)
+{
+  ntp_cache->using_ntpdate_valid = FALSE;
+}
+
+static void
+ntp_cache_ntpd_changed (GFileMonitor      *monitor,
+                        GFile             *file,
+                        GFile             *other_file,
+                        GFileMonitorEvent  event_type,
+                        gpointer           user_data)
+{
+  ntp_cache->ntpd_pid_valid = FALSE;
+}
+
+static GFileMonitor *
+ntp_cache_monitor (const gchar *path,
+                   gboolean     directory,
+                   GCallback    callback)
+{
+  GFileMonitor *monitor;
+  GError *error = NULL;
+  GFile *file;
+
+  file = g_file_new_for_path (path);
+
+  if (directory)
+    monitor = g_file_monitor_directory (file, G_FILE_MONITOR_NONE, NULL, &error);
+  else
+    monitor = g_file_monitor_file (file, G_FILE_MONITOR_NONE, NULL, &error);
+
+  if (monitor)
+    g_signal_connect (monitor, "changed", callback, NULL);
+  else
+    {
+      g_warning ("Unable to monitor %s: %s", path, error->message);
+      g_error_free (error);
+    }
+
+  g_object_unref (file);
+
+  return monitor;
+}
+
+static NtpCache *
+ntp_cache_get (void)
+{
+  if (!ntp_cache)
+    {
+      ntp_cache = g_slice_new0 (NtpCache);
+      ntp_cache->can_use_ntpdate = g_file_test (NTPDATE_AVAILABLE, G_FILE_TEST_EXISTS);
+      ntp_cache->can_use_ntpd = g_file_test (NTPD_AVAILABLE, G_FILE_TEST_EXISTS);
+
+      /* Without a monitor we can't cache, so the entry just never
+       * becomes valid.
+       */
+      if (ntp_cache->can_use_ntpdate)
+        ntp_cache->ntpdate_monitor = ntp_cache_monitor (NTPDATE_DIRECTORY, TRUE,
+                                                        G_CALLBACK (ntp_cache_ntpdate_changed));
+      if (ntp_cache->can_use_ntpd)
+        ntp_cache->ntpd_monitor = ntp_cache_monitor (NTPD_PIDFILE, FALSE,
+                                                     G_CALLBACK (ntp_cache_ntpd_changed));
+    }
+
+  return ntp_cache;
+}
 
 static gboolean
 ntp_unit_get_can_use_ntpdate (void)
 {
-  return g_file_test (NTPDATE_AVAILABLE, G_FILE_TEST_EXISTS);
+  return ntp_cache_get ()->can_use_ntpdate;
 }
 
 static gboolean
 ntp_unit_get_using_ntpdate (void)
 {
-  if (!ntp_unit_get_can_use_ntpdate ())
+  NtpCache *cache = ntp_cache_get ();
+
+  if (!cache->can_use_ntpdate)
     return FALSE;
 
-  return g_file_test (NTPDATE_ENABLED, G_FILE_TEST_EXISTS);
+  if (!cache->using_ntpdate_valid)
+    {
+      cache->using_ntpdate = g_file_test (NTPDATE_ENABLED, G_FILE_TEST_EXISTS);
+      cache->using_ntpdate_valid = cache->ntpdate_monitor != NULL;
+    }
+
+  return cache->using_ntpdate;
 }
 
 static gboolean
 ntp_unit_get_can_use_ntpd (void)
 {
-  return g_file_test (NTPD_AVAILABLE, G_FILE_TEST_EXISTS);
+  return ntp_cache_get ()->can_use_ntpd;
 }
 
+/* The same check as the init script's 'status' action */
 static gboolean
 ntp_unit_get_using_ntpd (void)
 {
-  int exit_status;
+  NtpCache *cache = ntp_cache_get ();
 
-  if (!ntp_unit_get_can_use_ntpd ())
+  if (!cache->can_use_ntpd)
     return FALSE;
 
-  if (!g_spawn_command_line_sync ("/usr/sbin/service ntp status", NULL, NULL, &exit_status, NULL))
+  if (!cache->ntpd_pid_valid)
+    {
+      gchar *contents;
+
+      cache->ntpd_pid = 0;
+
+      if (g_file_get_contents (NTPD_PIDFILE, &contents, NULL, NULL))
+        {
+          cache->ntpd_pid = (GPid) g_ascii_strtoll (contents, NULL, 10);
+          g_free (contents);
+        }
+
+      cache->ntpd_pid_valid = cache->ntpd_monitor != NULL;
+    }
+
+  if (cache->ntpd_pid <= 0)
     return FALSE;
 
-  return exit_status == 0;
+  return kill (cache->ntpd_pid, 0) == 0 || errno == EPERM;
+}
+
+/* Our own changes take effect before the monitors get to tell us */
+static void
+ntp_unit_invalidate (void)
+{
+  NtpCache *cache = ntp_cache_get ();
+
+  cache->using_ntpdate_valid = FALSE;
+  cache->ntpd_pid_valid = FALSE;
 }
 
+/* The setters run in a worker thread, so they must not touch the cache */
 static void
 ntp_unit_set_using_ntpdate (gboolean using_ntp)
 {
-  if (using_ntp == ntp_unit_get_using_ntpdate ())
+  if (using_ntp == g_file_test (NTPDATE_ENABLED, G_FILE_TEST_EXISTS))
     return;
 
   if (using_ntp)
@@ -94,30 +233,143 @@ ntp_unit_set_using_ntpd (gboolean using_ntp)
   g_free (cmd);
 }
 
-typedef Unit NtpUnit;
+typedef struct
+{
+  Unit parent_instance;
+
+  /* The state most recently asked for, and whether a worker is busy
+   * applying an earlier one.
+   */
+  gboolean wanted;
+  gboolean applying;
+
+  /* Start and stop requests waiting for the worker to settle */
+  GQueue pending;
+} NtpUnit;
+
 typedef UnitClass NtpUnitClass;
 static GType ntp_unit_get_type (void);
 
 G_DEFINE_TYPE (NtpUnit, ntp_unit, UNIT_TYPE)
 
+static void ntp_unit_apply (NtpUnit *nu);
+
+/* Runs in a worker thread: the ntpdate hook alone can take seconds */
 static void
-ntp_unit_start (Unit *unit)
+ntp_unit_apply_thread (GTask        *task,
+                       gpointer      source_object,
+                       gpointer      task_data,
+                       GCancellable *cancellable)
 {
-  if (ntp_unit_get_can_use_ntpdate ())
-    ntp_unit_set_using_ntpdate (TRUE);
+  gboolean using_ntp = GPOINTER_TO_INT (task_data);
+
+  if (g_file_test (NTPDATE_AVAILABLE, G_FILE_TEST_EXISTS))
+    ntp_unit_set_using_ntpdate (using_ntp);
 
-  if (ntp_unit_get_can_use_ntpd ())
-    ntp_unit_set_using_ntpd (TRUE);
+  if (g_file_test (NTPD_AVAILABLE, G_FILE_TEST_EXISTS))
+    ntp_unit_set_using_ntpd (using_ntp);
+
+  g_task_return_boolean (task, TRUE);
+}
+
+static void
+ntp_unit_applied (GObject      *source,
+                  GAsyncResult *result,
+                  gpointer      user_data)
+{
+  NtpUnit *nu = (NtpUnit *) source;
+  gboolean applied = GPOINTER_TO_INT (g_task_get_task_data (G_TASK (result)));
+  GTask *task;
+
+  nu->applying = FALSE;
+  ntp_unit_invalidate ();
+
+  /* Toggled again while we were busy: go straight to the latest state.
+   * Anything in between is never applied.
+   */
+  if (nu->wanted != applied)
+    {
+      ntp_unit_apply (nu);
+      return;
+    }
+
+  if (applied)
+    unit_set_active_state ((Unit *) nu, UNIT_ACTIVE, "running");
+  else
+    unit_set_active_state ((Unit *) nu, UNIT_INACTIVE, "dead");
+
+  while ((task = g_queue_pop_head (&nu->pending)))
+    {
+      g_task_return_boolean (task, TRUE);
+      g_object_unref (task);
+    }
 }
 
 static void
-ntp_unit_stop (Unit *unit)
+ntp_unit_apply (NtpUnit *nu)
 {
-  if (ntp_unit_get_can_use_ntpdate ())
-    ntp_unit_set_using_ntpdate (FALSE);
+  GTask *task;
 
-  if (ntp_unit_get_can_use_ntpd ())
-    ntp_unit_set_using_ntpd (FALSE);
+  nu->applying = TRUE;
+
+  task = g_task_new (nu, NULL, ntp_unit_applied, NULL);
+  g_task_set_task_data (task, GINT_TO_POINTER (nu->wanted), NULL);
+  g_task_run_in_thread (task, ntp_unit_apply_thread);
+  g_object_unref (task);
+}
+
+/* Enabling and disabling NTP is done as a job in a worker thread, so
+ * the main loop keeps serving everybody else meanwhile.  A UI that
+ * flips the switch back and forth only gets the last position applied:
+ * requests that arrive while a worker is busy just change what it will
+ * do next.
+ */
+static void
+ntp_unit_request (NtpUnit  *nu,
+                  gboolean  using_ntp)
+{
+  nu->wanted = using_ntp;
+
+  if (using_ntp)
+    unit_set_active_state ((Unit *) nu, UNIT_ACTIVATING, "start");
+  else
+    unit_set_active_state ((Unit *) nu, UNIT_DEACTIVATING, "stop");
+
+  if (!nu->applying)
+    ntp_unit_apply (nu);
+}
+
+static void
+ntp_unit_load (Unit *unit)
+{
+  NtpUnit *nu = (NtpUnit *) unit;
+
+  if (ntp_unit_get_using_ntpdate () || ntp_unit_get_using_ntpd ())
+    {
+      unit->active_state = UNIT_ACTIVE;
+      unit->sub_state = "running";
+      nu->wanted = TRUE;
+    }
+}
+
+static void
+ntp_unit_start_async (Unit  *unit,
+                      GTask *task)
+{
+  NtpUnit *nu = (NtpUnit *) unit;
+
+  g_queue_push_tail (&nu->pending, task);
+  ntp_unit_request (nu, TRUE);
+}
+
+static void
+ntp_unit_stop_async (Unit  *unit,
+                     GTask *task)
+{
+  NtpUnit *nu = (NtpUnit *) unit;
+
+  g_queue_push_tail (&nu->pending, task);
+  ntp_unit_request (nu, FALSE);
 }
 
 static const gchar *
@@ -129,24 +381,62 @@ ntp_unit_get_state (Unit *unit)
     return "disabled";
 }
 
+/* Straight from the kernel, as systemd-timedated does: no process is
+ * spawned, so this is fine to poll.  The errors are in microseconds.
+ */
+gboolean
+ntp_unit_get_sync_status (Unit     *unit,
+                          gboolean *synchronized,
+                          guint64  *estimated_error,
+                          guint64  *max_error)
+{
+  struct timex tx = { 0 };
+  int state;
+
+  if (!G_TYPE_CHECK_INSTANCE_TYPE (unit, ntp_unit_get_type ()))
+    return FALSE;
+
+  state = ntp_adjtime (&tx);
+
+  if (state < 0)
+    {
+      *synchronized = FALSE;
+      *estimated_error = 0;
+      *max_error = 0;
+      return TRUE;
+    }
+
+  *synchronized = state != TIME_ERROR && !(tx.status & STA_UNSYNC);
+  *estimated_error = tx.esterror;
+  *max_error = tx.maxerror;
+
+  return TRUE;
+}
+
 Unit *
 ntp_unit_get (void)
 {
-  if (ntp_unit_get_can_use_ntpdate () || ntp_unit_get_can_use_ntpd ())
-    return g_object_new (ntp_unit_get_type (), NULL);
+  static Unit *ntp_unit;
+
+  /* ntpd.service and systemd-timesyncd.service are the same thing to
+   * us, so they share the one object and its state.
+   */
+  if (!ntp_unit && (ntp_unit_get_can_use_ntpdate () || ntp_unit_get_can_use_ntpd ()))
+    ntp_unit = g_object_new (ntp_unit_get_type (), NULL);
 
-  return NULL;
+  return ntp_unit ? g_object_ref (ntp_unit) : NULL;
 }
 
 static void
-ntp_unit_init (Unit *unit)
+ntp_unit_init (NtpUnit *nu)
 {
 }
 
 static void
 ntp_unit_class_init (UnitClass *class)
 {
-  class->start = ntp_unit_start;
-  class->stop = ntp_unit_stop;
+  class->load = ntp_unit_load;
+  class->start_async = ntp_unit_start_async;
+  class->stop_async = ntp_unit_stop_async;
   class->get_state = ntp_unit_get_state;
 }
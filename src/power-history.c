@@ -0,0 +1,209 @@
+/*
+ * Copyright © 2014 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#include "power-history.h"
+
+#include <string.h>
+
+/* When each power action reached each of its phases, so that suspend
+ * and resume latency can be compared across kernel and driver updates.
+ * The times are CLOCK_REALTIME, in microseconds, since the monotonic
+ * clock stops while we are suspended.
+ *
+ * The StartUnit reply goes out (and is flushed) just before an action
+ * is requested of the unit, and JobRemoved just after it completes, so
+ * Requested and Completed are also when the caller heard from us.
+ *
+ * The last POWER_HISTORY_N_RECORDS actions are kept in /run, one line
+ * each, so that the history survives us exiting on idle between
+ * actions.  It goes away on reboot, which is what we want: comparing
+ * boots is up to whoever reads it.
+ */
+#define POWER_HISTORY_N_RECORDS 32
+
+typedef struct
+{
+  gchar action[40];
+  gboolean success;
+  gint64 times[N_POWER_PHASES];
+} PowerRecord;
+
+static const gchar * const power_phase_names[] = {
+  [POWER_PHASE_REQUESTED] = "Requested",
+  [POWER_PHASE_USER_SLICES_FROZEN] = "UserSlicesFrozen",
+  [POWER_PHASE_HOOKS_STARTED] = "HooksStarted",
+  [POWER_PHASE_HOOKS_FINISHED] = "HooksFinished",
+  [POWER_PHASE_KERNEL_ENTERED] = "KernelEntered",
+  [POWER_PHASE_RESUMED] = "Resumed",
+  [POWER_PHASE_RESUME_HOOKS_FINISHED] = "ResumeHooksFinished",
+  [POWER_PHASE_USER_SLICES_THAWED] = "UserSlicesThawed",
+  [POWER_PHASE_COMPLETED] = "Completed"
+};
+
+static PowerRecord power_records[POWER_HISTORY_N_RECORDS];
+static guint power_n_records;
+static gboolean power_history_loaded;
+static PowerRecord power_current;
+static gboolean power_in_progress;
+
+static void
+power_history_load (void)
+{
+  gchar *contents;
+  gchar **lines;
+  guint i;
+
+  if (power_history_loaded)
+    return;
+
+  power_history_loaded = TRUE;
+
+  if (!g_file_get_contents (POWER_HISTORY_FILENAME, &contents, NULL, NULL))
+    return;
+
+  lines = g_strsplit (contents, "\n", 0);
+
+  for (i = 0; lines[i] && power_n_records < POWER_HISTORY_N_RECORDS; i++)
+    {
+      PowerRecord *record = &power_records[power_n_records];
+      gchar **fields;
+      guint phase;
+
+      fields = g_strsplit (lines[i], " ", 0);
+
+      if (g_strv_length (fields) == 2 + N_POWER_PHASES)
+        {
+          g_strlcpy (record->action, fields[0], sizeof record->action);
+          record->success = g_str_equal (fields[1], "1");
+          for (phase = 0; phase < N_POWER_PHASES; phase++)
+            record->times[phase] = g_ascii_strtoll (fields[2 + phase], NULL, 10);
+          power_n_records++;
+        }
+
+      g_strfreev (fields);
+    }
+
+  g_strfreev (lines);
+  g_free (contents);
+}
+
+static void
+power_history_save (void)
+{
+  GError *error = NULL;
+  GString *contents;
+  guint i, phase;
+
+  contents = g_string_new (NULL);
+
+  for (i = 0; i < power_n_records; i++)
+    {
+      g_string_append_printf (contents, "%s %d", power_records[i].action, power_records[i].success);
+      for (phase = 0; phase < N_POWER_PHASES; phase++)
+        g_string_append_printf (contents, " %" G_GINT64_FORMAT, power_records[i].times[phase]);
+      g_string_append_c (contents, '\n');
+    }
+
+  if (!g_file_set_contents (POWER_HISTORY_FILENAME, contents->str, contents->len, &error))
+    {
+      g_warning ("Unable to write " POWER_HISTORY_FILENAME ": %s", error->message);
+      g_error_free (error);
+    }
+
+  g_string_free (contents, TRUE);
+}
+
+/* Starts recording the phases of 'action', marking it as requested now */
+void
+power_history_begin (const gchar *action)
+{
+  memset (&power_current, 0, sizeof power_current);
+  g_strlcpy (power_current.action, action, sizeof power_current.action);
+  power_current.times[POWER_PHASE_REQUESTED] = g_get_real_time ();
+  power_in_progress = TRUE;
+}
+
+/* Phases that are marked more than once (suspend-then-hibernate enters
+ * the kernel twice) keep the first time for entering and the last one
+ * for everything else.
+ */
+void
+power_history_mark (PowerPhase phase,
+                    gint64     real_time)
+{
+  g_return_if_fail (phase < N_POWER_PHASES);
+
+  if (!power_in_progress)
+    return;
+
+  if (phase == POWER_PHASE_KERNEL_ENTERED && power_current.times[phase])
+    return;
+
+  power_current.times[phase] = real_time;
+}
+
+void
+power_history_end (gboolean success)
+{
+  if (!power_in_progress)
+    return;
+
+  power_in_progress = FALSE;
+  power_current.success = success;
+  power_current.times[POWER_PHASE_COMPLETED] = g_get_real_time ();
+
+  power_history_load ();
+
+  if (power_n_records == POWER_HISTORY_N_RECORDS)
+    memmove (&power_records[0], &power_records[1], sizeof power_records[0] * --power_n_records);
+
+  power_records[power_n_records++] = power_current;
+
+  power_history_save ();
+}
+
+/* Oldest first, as a(sba{st}): the action, whether it succeeded, and
+ * the time of each phase it went through.
+ */
+GVariant *
+power_history_get_variant (void)
+{
+  GVariantBuilder builder;
+  guint i, phase;
+
+  power_history_load ();
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sba{st})"));
+
+  for (i = 0; i < power_n_records; i++)
+    {
+      g_variant_builder_open (&builder, G_VARIANT_TYPE ("(sba{st})"));
+      g_variant_builder_add (&builder, "s", power_records[i].action);
+      g_variant_builder_add (&builder, "b", power_records[i].success);
+      g_variant_builder_open (&builder, G_VARIANT_TYPE ("a{st}"));
+      for (phase = 0; phase < N_POWER_PHASES; phase++)
+        if (power_records[i].times[phase])
+          g_variant_builder_add (&builder, "{st}", power_phase_names[phase],
+                                 (guint64) power_records[i].times[phase]);
+      g_variant_builder_close (&builder);
+      g_variant_builder_close (&builder);
+    }
+
+  return g_variant_builder_end (&builder);
+}
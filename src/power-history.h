@@ -0,0 +1,50 @@
+/*
+ * Copyright © 2014 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#ifndef _power_history_h_
+#define _power_history_h_
+
+#include <glib.h>
+
+#define POWER_HISTORY_FILENAME "/run/systemd-shim-power-history"
+
+typedef enum
+{
+  POWER_PHASE_REQUESTED,
+  POWER_PHASE_USER_SLICES_FROZEN,
+  POWER_PHASE_HOOKS_STARTED,
+  POWER_PHASE_HOOKS_FINISHED,
+  POWER_PHASE_KERNEL_ENTERED,
+  POWER_PHASE_RESUMED,
+  POWER_PHASE_RESUME_HOOKS_FINISHED,
+  POWER_PHASE_USER_SLICES_THAWED,
+  POWER_PHASE_COMPLETED,
+  N_POWER_PHASES
+} PowerPhase;
+
+void power_history_begin (const gchar *action);
+
+void power_history_mark (PowerPhase phase,
+                         gint64     real_time);
+
+void power_history_end (gboolean success);
+
+GVariant * power_history_get_variant (void);
+
+#endif /* _power_history_h_ */
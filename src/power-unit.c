@@ -18,6 +18,11 @@
  */
 
 #include "unit.h"
+#include "probes.h"
+#include "kexec.h"
+#include "power-history.h"
+#include "settings.h"
+#include "sleep.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -32,35 +37,253 @@ const gchar *power_cmds[] = {
   [POWER_OFF] = "/sbin/shutdown -h now",
   [POWER_REBOOT] = "/sbin/reboot",
   [POWER_SUSPEND] = "/usr/sbin/pm-suspend",
-  [POWER_HIBERNATE] = "/usr/sbin/pm-hibernate"
+  [POWER_HIBERNATE] = "/usr/sbin/pm-hibernate",
+  [POWER_HYBRID_SLEEP] = "/usr/sbin/pm-suspend-hybrid",
+  /* pm-utils has nothing for this one, so it always goes native */
+  [POWER_SUSPEND_THEN_HIBERNATE] = NULL,
+  /* The kexec init script jumps into the loaded kernel at the end */
+  [POWER_KEXEC] = "/sbin/reboot"
+};
+
+static const SleepMode power_sleep_modes[] = {
+  [POWER_SUSPEND] = SLEEP_SUSPEND,
+  [POWER_HIBERNATE] = SLEEP_HIBERNATE,
+  [POWER_HYBRID_SLEEP] = SLEEP_HYBRID_SLEEP,
+  [POWER_SUSPEND_THEN_HIBERNATE] = SLEEP_SUSPEND_THEN_HIBERNATE
 };
 
 typedef struct
 {
   Unit parent_instance;
   PowerAction action;
+
+  /* Tasks waiting for the action in progress, if any */
+  GQueue pending;
+
+  gboolean froze_user_slices;
 } PowerUnit;
 
 G_DEFINE_TYPE (PowerUnit, power_unit, UNIT_TYPE)
 
 gboolean in_shutdown;
 
+/* Sleep requests are treated as jobs: while one sleep action is under
+ * way, another request for the same action is merged into it, and so
+ * is one that comes in right as we finish resuming from it.  A lid
+ * that is closed twice in a row, or logind retrying, therefore gets one
+ * suspend, not two.  A request for a different action (a hibernate on
+ * critical battery, say) waits its turn and runs after we resume.
+ */
+static PowerUnit *sleeping_unit;
+static PowerAction last_resume_action;
+static gint64 last_resume_time;
+static GQueue deferred_units;
+
+static void power_unit_sleep (PowerUnit *pu);
+
+static void
+power_unit_return_pending (PowerUnit *pu)
+{
+  GTask *task;
+
+  while ((task = g_queue_pop_head (&pu->pending)))
+    {
+      g_task_return_boolean (task, TRUE);
+      g_object_unref (task);
+    }
+}
+
 static void
-power_unit_start (Unit *unit)
+power_unit_done (PowerUnit *pu,
+                 gboolean   success)
+{
+  Unit *unit = (Unit *) pu;
+
+  if (pu == sleeping_unit)
+    {
+      last_resume_action = pu->action;
+      last_resume_time = g_get_monotonic_time ();
+      sleeping_unit = NULL;
+    }
+
+  SHIM_PROBE2 (power_done, pu->action, success);
+
+  /* Only now that everything else is back up */
+  if (pu->froze_user_slices)
+    {
+      cgroup_units_freeze_user_slices (FALSE);
+      power_history_mark (POWER_PHASE_USER_SLICES_THAWED, g_get_real_time ());
+      pu->froze_user_slices = FALSE;
+    }
+
+  power_history_end (success);
+
+  if (pu->action == POWER_OFF || pu->action == POWER_REBOOT || pu->action == POWER_KEXEC)
+    {
+      if (!success)
+        unit_set_active_state (unit, UNIT_FAILED, "failed");
+    }
+
+  /* We are back: the target is no longer active */
+  else if (success)
+    unit_set_active_state (unit, UNIT_INACTIVE, "dead");
+  else
+    unit_set_active_state (unit, UNIT_FAILED, "failed");
+
+  power_unit_return_pending (pu);
+
+  if (!sleeping_unit && !g_queue_is_empty (&deferred_units))
+    {
+      PowerUnit *next = g_queue_pop_head (&deferred_units);
+
+      if (in_shutdown)
+        power_unit_return_pending (next);
+      else
+        power_unit_sleep (next);
+
+      g_object_unref (next);
+    }
+}
+
+static void
+power_unit_child_exited (GPid     pid,
+                         gint     status,
+                         gpointer user_data)
+{
+  PowerUnit *pu = user_data;
+  GError *error = NULL;
+  gboolean success;
+
+  success = g_spawn_check_exit_status (status, &error);
+
+  if (!success)
+    {
+      g_warning ("Error while running '%s': %s", power_cmds[pu->action], error->message);
+      g_error_free (error);
+    }
+
+  g_spawn_close_pid (pid);
+
+  power_unit_done (pu, success);
+  g_object_unref (pu);
+}
+
+static gboolean
+power_unit_spawn (PowerUnit *pu)
+{
+  GError *error = NULL;
+  gchar **argv = NULL;
+  GPid pid;
+
+  SHIM_PROBE2 (power_exec, pu->action, power_cmds[pu->action]);
+
+  if (!g_shell_parse_argv (power_cmds[pu->action], NULL, &argv, &error) ||
+      !g_spawn_async (NULL, argv, NULL, G_SPAWN_DO_NOT_REAP_CHILD, NULL, NULL, &pid, &error))
+    {
+      g_warning ("Error while running '%s': %s", power_cmds[pu->action], error->message);
+      g_error_free (error);
+      g_strfreev (argv);
+      return FALSE;
+    }
+
+  g_strfreev (argv);
+
+  g_child_watch_add (pid, power_unit_child_exited, g_object_ref (pu));
+
+  return TRUE;
+}
+
+static void
+power_unit_slept (GObject      *source_object,
+                  GAsyncResult *result,
+                  gpointer      user_data)
+{
+  PowerUnit *pu = user_data;
+  GError *error = NULL;
+  gboolean success;
+
+  success = sleep_run_finish (result, &error);
+
+  if (!success)
+    {
+      g_warning ("Native %s failed: %s", unit_get_name ((Unit *) pu), error->message);
+      g_error_free (error);
+    }
+
+  power_unit_done (pu, success);
+  g_object_unref (pu);
+}
+
+static void
+power_unit_kexec_loaded (GObject      *source_object,
+                         GAsyncResult *result,
+                         gpointer      user_data)
+{
+  PowerUnit *pu = user_data;
+  GError *error = NULL;
+
+  if (!kexec_load_finish (result, &error))
+    {
+      g_warning ("Unable to load kexec kernel, doing a normal reboot: %s", error->message);
+      g_error_free (error);
+    }
+
+  if (!power_unit_spawn (pu))
+    power_unit_done (pu, FALSE);
+
+  g_object_unref (pu);
+}
+
+static void
+power_unit_kexec_unloaded (GObject      *source_object,
+                           GAsyncResult *result,
+                           gpointer      user_data)
+{
+  PowerUnit *pu = user_data;
+
+  /* Already warned about: reboot regardless */
+  kexec_unload_finish (result, NULL);
+
+  if (!power_unit_spawn (pu))
+    power_unit_done (pu, FALSE);
+
+  g_object_unref (pu);
+}
+
+/* The command (or our own sleep engine) runs without blocking
+ * the main loop, so we keep answering requests until we go down, and
+ * the caller hears back via the task once the action is over, which for
+ * suspend and hibernate means after resume.
+ */
+static void
+power_unit_start_async (Unit  *unit,
+                        GTask *task)
 {
   PowerUnit *pu = (PowerUnit *) unit;
-  static gint64 last_suspend_time;
+  gboolean in_progress;
+
+  SHIM_PROBE2 (power_start, pu->action, in_shutdown);
+
+  /* A repeated request while the action is under way just waits for it
+   * to finish.
+   */
+  in_progress = !g_queue_is_empty (&pu->pending);
+  g_queue_push_tail (&pu->pending, task);
+  if (in_progress)
+    return;
 
   /* If we request power off or reboot actions then we should ignore any
    * suspend or hibernate actions that come after this.
    */
-  if (pu->action == POWER_OFF || pu->action == POWER_REBOOT)
+  if (pu->action == POWER_OFF || pu->action == POWER_REBOOT || pu->action == POWER_KEXEC)
     {
       GError *error = NULL;
+      gboolean use_kexec;
       gchar *pid_str;
       gboolean success;
 
       in_shutdown = TRUE;
+      power_history_begin (unit->name);
 
       /* avoid being killed during shutdown, so that we can keep our
        * in_shutdown state */
@@ -73,53 +296,104 @@ power_unit_start (Unit *unit)
           g_error_free (error);
         }
 
-      if (system (power_cmds[pu->action]) != 0)
-        g_warning ("Error while running '%s'", power_cmds[pu->action]);
+      unit_set_active_state (unit, UNIT_ACTIVE, "active");
+
+      /* With [Kexec] Reboot=true, a reboot goes through kexec if there
+       * is a kernel staged.  Otherwise a kernel that we preloaded must
+       * not be used by the kexec init script, so we take it out again;
+       * one staged by anybody else is theirs to deal with.
+       */
+      use_kexec = pu->action == POWER_KEXEC;
+
+      if (pu->action == POWER_REBOOT && kexec_is_loaded () &&
+          settings_get_boolean ("Kexec", "Reboot", FALSE))
+        use_kexec = TRUE;
+
+      if (use_kexec)
+        {
+          /* Normally preloaded, in which case this is immediate */
+          kexec_load_async (power_unit_kexec_loaded, g_object_ref (pu));
+          return;
+        }
+
+      if (pu->action == POWER_REBOOT)
+        {
+          kexec_unload_async (power_unit_kexec_unloaded, g_object_ref (pu));
+          return;
+        }
+
+      if (!power_unit_spawn (pu))
+        power_unit_done (pu, FALSE);
     }
   else
     {
       if (in_shutdown)
-        return;
-
-      /* This is pretty ugly: if we are being asked to perform a suspend
-       * or hibernate action within 1 second of the previous one, don't
-       * do it.
-       *
-       * We will be able to do this properly once we forward the
-       * timestamp of the event that caused the suspend all the way
-       * down.
-       */
-      if (pu->action == POWER_SUSPEND && last_suspend_time + G_TIME_SPAN_SECOND > g_get_monotonic_time ())
-        return;
+        {
+          power_unit_return_pending (pu);
+          return;
+        }
 
-      /* pm-utils might not have been installed, so go the direct route
-       * if we find that we don't have it...
-       */
-      if (g_file_test (power_cmds[pu->action], G_FILE_TEST_IS_EXECUTABLE))
+      if (sleeping_unit && sleeping_unit->action == pu->action)
         {
-          if (system (power_cmds[pu->action]) != 0)
-            g_warning ("Error while running '%s'", power_cmds[pu->action]);
+          SHIM_PROBE1 (power_merged, pu->action);
+          g_debug ("Merging %s into %s in progress", unit->name, unit_get_name ((Unit *) sleeping_unit));
+          g_queue_push_tail (&sleeping_unit->pending, g_queue_pop_head (&pu->pending));
+          return;
         }
-      else
+
+      if (sleeping_unit)
+        {
+          g_debug ("Running %s after %s in progress", unit->name, unit_get_name ((Unit *) sleeping_unit));
+          g_queue_push_tail (&deferred_units, g_object_ref (pu));
+          return;
+        }
+
+      /* Still the same event, just late: the request was on its way
+       * while we were going down or coming back up.
+       */
+      if (last_resume_time && last_resume_action == pu->action &&
+          g_get_monotonic_time () - last_resume_time < settings_get_int ("Sleep", "ResumeGraceMSec", 1000) * 1000)
         {
-          const gchar *kind;
-          gint fd;
-
-          fd = open ("/sys/power/state", O_WRONLY);
-          if (fd == -1)
-            {
-              g_warning ("Could not open /sys/power/state");
-              return;
-            }
-
-          kind = (pu->action == POWER_SUSPEND) ? "mem" : "disk";
-          if (write (fd, kind, strlen (kind)) != strlen (kind))
-            g_warning ("Failed to write() to /sys/power/state?!?");
-          close (fd);
+          SHIM_PROBE1 (power_collapsed, pu->action);
+          g_debug ("Ignoring %s right after resume", unit->name);
+          power_unit_return_pending (pu);
+          return;
         }
 
-      if (pu->action == POWER_SUSPEND)
-        last_suspend_time = g_get_monotonic_time ();
+      power_unit_sleep (pu);
+    }
+}
+
+static void
+power_unit_sleep (PowerUnit *pu)
+{
+  Unit *unit = (Unit *) pu;
+
+  sleeping_unit = pu;
+
+  power_history_begin (unit->name);
+  unit_set_active_state (unit, UNIT_ACTIVE, "active");
+
+  if (settings_get_boolean ("Sleep", "FreezeUserSlices", FALSE))
+    {
+      cgroup_units_freeze_user_slices (TRUE);
+      power_history_mark (POWER_PHASE_USER_SLICES_FROZEN, g_get_real_time ());
+      pu->froze_user_slices = TRUE;
+    }
+
+  /* Use pm-utils if we have it, unless configured otherwise; our
+   * own engine runs hooks in parallel, so it is faster.
+   */
+  if (!settings_get_boolean ("Sleep", "Native", FALSE) && power_cmds[pu->action] &&
+      g_file_test (power_cmds[pu->action], G_FILE_TEST_IS_EXECUTABLE))
+    {
+      if (!power_unit_spawn (pu))
+        power_unit_done (pu, FALSE);
+    }
+  else
+    {
+      SHIM_PROBE2 (power_exec, pu->action, "native");
+      sleep_run_async (power_sleep_modes[pu->action], power_unit_slept, g_object_ref (pu));
     }
 }
 
@@ -155,7 +429,8 @@ power_unit_init (PowerUnit *unit)
 static void
 power_unit_class_init (UnitClass *class)
 {
-  class->start = power_unit_start;
+  class->disruptive = TRUE;
+  class->start_async = power_unit_start_async;
   class->stop = power_unit_stop;
   class->get_state = power_unit_get_state;
 }
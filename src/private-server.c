@@ -0,0 +1,170 @@
+/*
+ * Copyright © 2014 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#include "private-server.h"
+
+#include <glib/gstdio.h>
+#include <errno.h>
+
+/* Privileged local clients (logind, the cgroup release agent) can talk
+ * to us directly over a peer-to-peer connection on PRIVATE_SERVER_PATH
+ * instead of going through dbus-daemon.  The same objects are exported
+ * there as on the bus.
+ *
+ * Peers authenticate with EXTERNAL, which means that the credentials
+ * come from SO_PEERCRED on the socket, and only root is let in.
+ * Messages on these connections have no sender, so each connection is
+ * treated as a client of its own.
+ */
+
+static GDBusServer *server;
+static GPtrArray *connections;
+static PrivateServerConnectionFunc connection_func;
+
+static gboolean
+private_server_allow_mechanism (GDBusAuthObserver *observer,
+                                const gchar       *mechanism,
+                                gpointer           user_data)
+{
+  return g_str_equal (mechanism, "EXTERNAL");
+}
+
+static gboolean
+private_server_authorize (GDBusAuthObserver *observer,
+                          GIOStream         *stream,
+                          GCredentials      *credentials,
+                          gpointer           user_data)
+{
+  uid_t uid;
+
+  if (credentials == NULL)
+    {
+      g_debug ("Rejecting private connection without credentials");
+      return FALSE;
+    }
+
+  uid = g_credentials_get_unix_user (credentials, NULL);
+
+  if (uid != 0)
+    {
+      g_debug ("Rejecting private connection from uid %d", (gint) uid);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static void
+private_server_connection_closed (GDBusConnection *connection,
+                                  gboolean         remote_peer_vanished,
+                                  GError          *error,
+                                  gpointer         user_data)
+{
+  g_debug ("Private connection closed");
+
+  g_signal_handlers_disconnect_by_func (connection, private_server_connection_closed, NULL);
+  g_ptr_array_remove (connections, connection);
+}
+
+static gboolean
+private_server_new_connection (GDBusServer     *server,
+                               GDBusConnection *connection,
+                               gpointer         user_data)
+{
+  g_debug ("New private connection");
+
+  g_ptr_array_add (connections, g_object_ref (connection));
+  g_signal_connect (connection, "closed", G_CALLBACK (private_server_connection_closed), NULL);
+
+  (* connection_func) (connection);
+
+  return TRUE;
+}
+
+gboolean
+private_server_start (PrivateServerConnectionFunc   new_connection,
+                      GError                      **error)
+{
+  GDBusAuthObserver *observer;
+  gchar *guid;
+
+  g_return_val_if_fail (server == NULL, FALSE);
+
+  if (g_mkdir_with_parents (PRIVATE_SERVER_DIRECTORY, 0755) != 0)
+    {
+      gint saved_errno = errno;
+
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                   "Unable to create " PRIVATE_SERVER_DIRECTORY ": %s", g_strerror (saved_errno));
+      return FALSE;
+    }
+
+  /* We only get here once we own our bus name, so anything left at the
+   * path is from an instance that is no longer running.
+   */
+  g_unlink (PRIVATE_SERVER_PATH);
+
+  observer = g_dbus_auth_observer_new ();
+  g_signal_connect (observer, "allow-mechanism", G_CALLBACK (private_server_allow_mechanism), NULL);
+  g_signal_connect (observer, "authorize-authenticated-peer", G_CALLBACK (private_server_authorize), NULL);
+
+  guid = g_dbus_generate_guid ();
+  server = g_dbus_server_new_sync (PRIVATE_SERVER_ADDRESS, G_DBUS_SERVER_FLAGS_NONE, guid, observer, NULL, error);
+  g_object_unref (observer);
+  g_free (guid);
+
+  if (server == NULL)
+    return FALSE;
+
+  connection_func = new_connection;
+  connections = g_ptr_array_new_with_free_func (g_object_unref);
+
+  g_signal_connect (server, "new-connection", G_CALLBACK (private_server_new_connection), NULL);
+  g_dbus_server_start (server);
+
+  g_debug ("Listening on " PRIVATE_SERVER_ADDRESS);
+
+  return TRUE;
+}
+
+/* Flushes anything still queued up for our peers and stops listening */
+void
+private_server_stop (void)
+{
+  guint i;
+
+  if (server == NULL)
+    return;
+
+  g_dbus_server_stop (server);
+  g_clear_object (&server);
+
+  for (i = 0; i < connections->len; i++)
+    {
+      GDBusConnection *connection = g_ptr_array_index (connections, i);
+
+      g_signal_handlers_disconnect_by_func (connection, private_server_connection_closed, NULL);
+      g_dbus_connection_flush_sync (connection, NULL, NULL);
+    }
+
+  g_ptr_array_unref (connections);
+  connections = NULL;
+
+  g_unlink (PRIVATE_SERVER_PATH);
+}
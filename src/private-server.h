@@ -0,0 +1,36 @@
+/*
+ * Copyright © 2014 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#ifndef _private_server_h_
+#define _private_server_h_
+
+#include <gio/gio.h>
+
+#define PRIVATE_SERVER_DIRECTORY "/run/systemd-shim"
+#define PRIVATE_SERVER_PATH      PRIVATE_SERVER_DIRECTORY "/private"
+#define PRIVATE_SERVER_ADDRESS   "unix:path=" PRIVATE_SERVER_PATH
+
+typedef void (* PrivateServerConnectionFunc) (GDBusConnection *connection);
+
+gboolean private_server_start (PrivateServerConnectionFunc   new_connection,
+                               GError                      **error);
+
+void private_server_stop (void);
+
+#endif /* _private_server_h_ */
@@ -0,0 +1,91 @@
+/*
+ * Copyright © 2014 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#ifndef _probes_h_
+#define _probes_h_
+
+#include "config.h"
+
+/* Static tracepoints for SystemTap/bpftrace, eg:
+ *
+ *   bpftrace -e 'usdt:$libexecdir/systemd-shim:systemd_shim:cgmanager_call_return
+ *                { @[str(arg0)] = hist(arg2); }'
+ *
+ * When built with --enable-sdt each probe is a nop plus a note in the
+ * ELF file, behind a test of its semaphore: the tracer bumps that while
+ * it is attached, so the arguments (time deltas, string lookups) are
+ * only worked out while somebody is listening.  Without --enable-sdt
+ * they compile away entirely.
+ *
+ * Every probe needs a semaphore, so every probe has to be listed here.
+ */
+#define SHIM_PROBES \
+  SHIM_PROBE_NAME (activation_ready) \
+  SHIM_PROBE_NAME (activation_start) \
+  SHIM_PROBE_NAME (cgmanager_call_entry) \
+  SHIM_PROBE_NAME (cgmanager_call_return) \
+  SHIM_PROBE_NAME (cgmanager_create) \
+  SHIM_PROBE_NAME (cgmanager_freeze) \
+  SHIM_PROBE_NAME (cgmanager_kill) \
+  SHIM_PROBE_NAME (inactivity_exit) \
+  SHIM_PROBE_NAME (kexec_load) \
+  SHIM_PROBE_NAME (kexec_loaded) \
+  SHIM_PROBE_NAME (kexec_unload) \
+  SHIM_PROBE_NAME (power_collapsed) \
+  SHIM_PROBE_NAME (power_done) \
+  SHIM_PROBE_NAME (power_exec) \
+  SHIM_PROBE_NAME (power_merged) \
+  SHIM_PROBE_NAME (power_start) \
+  SHIM_PROBE_NAME (service_done) \
+  SHIM_PROBE_NAME (service_exec) \
+  SHIM_PROBE_NAME (sleep_enter) \
+  SHIM_PROBE_NAME (sleep_hook) \
+  SHIM_PROBE_NAME (sleep_resumed) \
+  SHIM_PROBE_NAME (state_sync_begin) \
+  SHIM_PROBE_NAME (state_sync_end) \
+  SHIM_PROBE_NAME (unit_file_set_enabled) \
+  SHIM_PROBE_NAME (unit_files_loaded)
+
+#ifdef ENABLE_SDT
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define SHIM_PROBE_SEMAPHORE(name)         systemd_shim_##name##_semaphore
+#define SHIM_PROBE_NAME(name)              extern unsigned short SHIM_PROBE_SEMAPHORE (name);
+SHIM_PROBES
+#undef SHIM_PROBE_NAME
+
+#define SHIM_PROBE_ENABLED(name)           __builtin_expect (SHIM_PROBE_SEMAPHORE (name) != 0, 0)
+
+#define SHIM_PROBE(name) \
+  do { if (SHIM_PROBE_ENABLED (name)) DTRACE_PROBE (systemd_shim, name); } while (0)
+#define SHIM_PROBE1(name, a) \
+  do { if (SHIM_PROBE_ENABLED (name)) DTRACE_PROBE1 (systemd_shim, name, a); } while (0)
+#define SHIM_PROBE2(name, a, b) \
+  do { if (SHIM_PROBE_ENABLED (name)) DTRACE_PROBE2 (systemd_shim, name, a, b); } while (0)
+#define SHIM_PROBE3(name, a, b, c) \
+  do { if (SHIM_PROBE_ENABLED (name)) DTRACE_PROBE3 (systemd_shim, name, a, b, c); } while (0)
+#else
+#define SHIM_PROBE(name)                   do { } while (0)
+#define SHIM_PROBE1(name, a)               do { } while (0)
+#define SHIM_PROBE2(name, a, b)            do { } while (0)
+#define SHIM_PROBE3(name, a, b, c)         do { } while (0)
+#endif
+
+#endif /* _probes_h_ */
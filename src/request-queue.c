@@ -0,0 +1,390 @@
+/*
+ * Copyright © 2014 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#include "request-queue.h"
+
+#include "settings.h"
+#include "stats.h"
+
+/* Incoming method calls are not handled directly from GDBus but are
+ * queued per sender and dispatched one at a time from an idle handler,
+ * taking turns between senders.  A client flooding us with requests
+ * therefore only delays its own requests, and GDBus gets to hand us new
+ * messages (from other clients) between each one.
+ *
+ * Requests are also split into classes (power actions, session setup,
+ * everything else, teardown).  Each sender's requests are always handled
+ * in the order they were sent, since logind relies on a StopUnit being
+ * done before the StartUnit that follows it.  Between senders, though,
+ * the one whose next request is of the highest class goes first: a
+ * suspend request from one client that comes in behind a burst of
+ * StopUnit calls from another is handled as soon as the current request
+ * finishes instead of waiting for all of them.  So that a steady stream
+ * of session setup can't hold up teardown forever, a request that has
+ * waited longer than MAX_REQUEST_DELAY goes before those of higher
+ * classes, except power actions: nothing ever goes before those.
+ *
+ * Each sender also has a token bucket: a sender that runs out of tokens
+ * gets its requests rejected with RATE_LIMITED_ERROR until the bucket
+ * refills.  Root is exempt: that is logind, which must never have a
+ * session start or stop refused during a login storm.
+ */
+#define RATE_LIMITED_ERROR "com.ubuntu.SystemdShim.Error.RateLimited"
+
+/* Only clean up the table of senders once it gets this big */
+#define MAX_IDLE_SENDERS 64
+
+#define MAX_REQUEST_DELAY (500 * G_TIME_SPAN_MILLISECOND)
+
+typedef struct
+{
+  gchar *name;
+  gdouble tokens;
+  gint64 last_refill;
+  GQueue requests;
+  gboolean ready;
+
+  /* Looked up in the background when we first see the sender */
+  gboolean exempt;
+} Sender;
+
+typedef struct
+{
+  GDBusMethodInvocation *invocation;
+  GDBusInterfaceMethodCallFunc func;
+  gpointer user_data;
+  GDestroyNotify notify;
+  RequestClass class;
+  gint64 queued_time;
+} Request;
+
+static const gchar * const request_class_names[] = {
+  [REQUEST_CLASS_POWER] = "power",
+  [REQUEST_CLASS_SESSION] = "session",
+  [REQUEST_CLASS_DEFAULT] = "default",
+  [REQUEST_CLASS_TEARDOWN] = "teardown"
+};
+
+static GHashTable *senders;
+static GQueue ready_senders[N_REQUEST_CLASSES];
+static guint dispatch_id;
+
+static gdouble rate_limit;
+static gdouble rate_burst;
+
+static void
+sender_free (gpointer data)
+{
+  Sender *sender = data;
+
+  g_assert (g_queue_is_empty (&sender->requests));
+
+  g_free (sender->name);
+  g_slice_free (Sender, sender);
+}
+
+static void
+sender_refill (Sender *sender,
+               gint64  now)
+{
+  gdouble elapsed;
+
+  elapsed = (gdouble) (now - sender->last_refill) / G_TIME_SPAN_SECOND;
+  sender->tokens = MIN (sender->tokens + elapsed * rate_limit, rate_burst);
+  sender->last_refill = now;
+}
+
+static gboolean
+sender_is_idle (gpointer key,
+                gpointer value,
+                gpointer user_data)
+{
+  Sender *sender = value;
+
+  if (sender->ready)
+    return FALSE;
+
+  sender_refill (sender, g_get_monotonic_time ());
+
+  return sender->tokens >= rate_burst;
+}
+
+static void
+sender_got_unix_user (GObject      *source_object,
+                      GAsyncResult *result,
+                      gpointer      user_data)
+{
+  gchar *name = user_data;
+  GVariant *reply;
+  Sender *sender;
+
+  reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object), result, NULL);
+
+  /* The sender may have been forgotten in the meantime */
+  sender = senders ? g_hash_table_lookup (senders, name) : NULL;
+
+  if (reply && sender)
+    {
+      guint32 uid;
+
+      g_variant_get (reply, "(u)", &uid);
+      sender->exempt = uid == 0;
+    }
+
+  if (reply)
+    g_variant_unref (reply);
+
+  g_free (name);
+}
+
+/* Finds out whether 'sender' is root without holding up the dispatch of
+ * anybody's requests: until the answer comes back, the sender is rate
+ * limited like everybody else, which only matters if it uses up its
+ * whole burst before dbus-daemon replies.
+ */
+static void
+sender_check_exempt (Sender                *sender,
+                     GDBusMethodInvocation *invocation)
+{
+  const gchar *name = g_dbus_method_invocation_get_sender (invocation);
+
+  /* Only root can connect to the private socket */
+  if (name == NULL)
+    {
+      sender->exempt = TRUE;
+      return;
+    }
+
+  g_dbus_connection_call (g_dbus_method_invocation_get_connection (invocation),
+                          "org.freedesktop.DBus", "/org/freedesktop/DBus",
+                          "org.freedesktop.DBus", "GetConnectionUnixUser",
+                          g_variant_new ("(s)", name), G_VARIANT_TYPE ("(u)"),
+                          G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+                          sender_got_unix_user, g_strdup (sender->name));
+}
+
+static Sender *
+get_sender (const gchar           *name,
+            GDBusMethodInvocation *invocation)
+{
+  Sender *sender;
+
+  if (!senders)
+    {
+      senders = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, sender_free);
+
+      rate_limit = settings_get_int ("RateLimit", "RequestsPerSecond", 50);
+      rate_burst = MAX (settings_get_int ("RateLimit", "Burst", 200), 1);
+    }
+
+  sender = g_hash_table_lookup (senders, name);
+
+  if (!sender)
+    {
+      /* Forget about senders that have nothing queued and a full bucket:
+       * they would be recreated in the same state.
+       */
+      if (g_hash_table_size (senders) >= MAX_IDLE_SENDERS)
+        g_hash_table_foreach_remove (senders, sender_is_idle, NULL);
+
+      sender = g_slice_new0 (Sender);
+      sender->name = g_strdup (name);
+      sender->tokens = rate_burst;
+      sender->last_refill = g_get_monotonic_time ();
+      g_hash_table_insert (senders, sender->name, sender);
+
+      if (rate_limit > 0)
+        sender_check_exempt (sender, invocation);
+    }
+
+  return sender;
+}
+
+static void
+request_free (Request *request)
+{
+  if (request->notify)
+    request->notify (request->user_data);
+
+  g_object_unref (request->invocation);
+  g_slice_free (Request, request);
+}
+
+static void
+request_run (Request *request)
+{
+  GDBusMethodInvocation *invocation = request->invocation;
+
+  stats_record_queue_wait (request_class_names[request->class],
+                           g_get_monotonic_time () - request->queued_time);
+
+  /* The handler always consumes a reference on the invocation */
+  request->func (g_dbus_method_invocation_get_connection (invocation),
+                 g_dbus_method_invocation_get_sender (invocation),
+                 g_dbus_method_invocation_get_object_path (invocation),
+                 g_dbus_method_invocation_get_interface_name (invocation),
+                 g_dbus_method_invocation_get_method_name (invocation),
+                 g_dbus_method_invocation_get_parameters (invocation),
+                 g_object_ref (invocation),
+                 request->user_data);
+}
+
+/* Puts 'sender' at the back of the line for the class of its next
+ * request.
+ */
+static void
+sender_make_ready (Sender *sender)
+{
+  Request *next = g_queue_peek_head (&sender->requests);
+
+  g_queue_push_tail (&ready_senders[next->class], sender);
+  sender->ready = TRUE;
+}
+
+/* The highest class with a sender waiting.  Below the power class,
+ * a request at the front of some class that has been waiting too long
+ * goes first instead: the one that has waited longest.
+ */
+static gint
+request_queue_pick_class (void)
+{
+  gint64 oldest = G_MAXINT64;
+  gint highest = -1;
+  gint aged = -1;
+  gint64 now;
+  guint class;
+
+  if (!g_queue_is_empty (&ready_senders[REQUEST_CLASS_POWER]))
+    return REQUEST_CLASS_POWER;
+
+  now = g_get_monotonic_time ();
+
+  for (class = REQUEST_CLASS_POWER + 1; class < N_REQUEST_CLASSES; class++)
+    {
+      Sender *sender;
+      Request *head;
+
+      sender = g_queue_peek_head (&ready_senders[class]);
+      if (sender == NULL)
+        continue;
+
+      if (highest < 0)
+        highest = class;
+
+      head = g_queue_peek_head (&sender->requests);
+      if (now - head->queued_time > MAX_REQUEST_DELAY && head->queued_time < oldest)
+        {
+          oldest = head->queued_time;
+          aged = class;
+        }
+    }
+
+  return aged >= 0 ? aged : highest;
+}
+
+static gboolean
+request_queue_dispatch (gpointer user_data)
+{
+  Sender *sender;
+  Request *request;
+  gint class;
+
+  class = request_queue_pick_class ();
+
+  if (class < 0)
+    {
+      dispatch_id = 0;
+      return FALSE;
+    }
+
+  sender = g_queue_pop_head (&ready_senders[class]);
+  request = g_queue_pop_head (&sender->requests);
+
+  /* Go to the back of the line if there is more to do */
+  sender->ready = FALSE;
+  if (!g_queue_is_empty (&sender->requests))
+    sender_make_ready (sender);
+
+  request_run (request);
+  request_free (request);
+
+  return TRUE;
+}
+
+void
+request_queue_push (GDBusMethodInvocation        *invocation,
+                    RequestClass                  class,
+                    GDBusInterfaceMethodCallFunc  func,
+                    gpointer                      user_data,
+                    GDestroyNotify                notify)
+{
+  gchar peer_name[32];
+  const gchar *name;
+  Request *request;
+  Sender *sender;
+
+  name = g_dbus_method_invocation_get_sender (invocation);
+
+  /* Messages on a peer-to-peer connection have no sender: the
+   * connection itself is the client.
+   */
+  if (name == NULL)
+    {
+      g_snprintf (peer_name, sizeof peer_name, "peer:%p", g_dbus_method_invocation_get_connection (invocation));
+      name = peer_name;
+    }
+
+  sender = get_sender (name, invocation);
+
+  if (rate_limit > 0)
+    {
+      sender_refill (sender, g_get_monotonic_time ());
+
+      if (sender->tokens < 1 && !sender->exempt)
+        {
+          g_debug ("Rate limiting %s from %s", g_dbus_method_invocation_get_method_name (invocation), sender->name);
+          stats_record_throttled (g_dbus_method_invocation_get_method_name (invocation));
+          g_dbus_method_invocation_return_dbus_error (invocation, RATE_LIMITED_ERROR,
+                                                      "Too many requests; try again later");
+          if (notify)
+            notify (user_data);
+          return;
+        }
+
+      sender->tokens = MAX (sender->tokens - 1, 0);
+    }
+
+  request = g_slice_new (Request);
+  request->invocation = invocation;
+  request->func = func;
+  request->user_data = user_data;
+  request->notify = notify;
+  request->class = class;
+  request->queued_time = g_get_monotonic_time ();
+  g_queue_push_tail (&sender->requests, request);
+
+  if (!sender->ready)
+    sender_make_ready (sender);
+
+  /* Default priority, not idle priority: the same as GDBus uses to
+   * deliver messages to us, so that we interleave with it.
+   */
+  if (!dispatch_id)
+    dispatch_id = g_idle_add_full (G_PRIORITY_DEFAULT, request_queue_dispatch, NULL, NULL);
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright © 2014 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#ifndef _request_queue_h_
+#define _request_queue_h_
+
+#include <gio/gio.h>
+
+/* In order of priority: between senders, the next request of a higher
+ * class is handled before one of a lower class.  A single sender's
+ * requests are always handled in order.
+ */
+typedef enum
+{
+  REQUEST_CLASS_POWER,
+  REQUEST_CLASS_SESSION,
+  REQUEST_CLASS_DEFAULT,
+  REQUEST_CLASS_TEARDOWN,
+  N_REQUEST_CLASSES
+} RequestClass;
+
+void request_queue_push (GDBusMethodInvocation        *invocation,
+                         RequestClass                  class,
+                         GDBusInterfaceMethodCallFunc  func,
+                         gpointer                      user_data,
+                         GDestroyNotify                notify);
+
+#endif /* _request_queue_h_ */
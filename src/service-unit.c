@@ -0,0 +1,461 @@
+/*
+ * Copyright © 2014 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#include "unit.h"
+#include "unit-files.h"
+#include "probes.h"
+
+#include <signal.h>
+#include <string.h>
+#include <errno.h>
+#include <glib/gstdio.h>
+
+#define SERVICES_FILENAME SYSCONFDIR "/systemd-shim-services.conf"
+
+/* How long the answer from 'initctl status' is believed for upstart
+ * jobs that have no pidfile we could look at instead.
+ */
+#define STATUS_CACHE_USEC (2 * G_TIME_SPAN_SECOND)
+
+/* NAME.service maps onto the SysV init script or upstart job NAME,
+ * started and stopped with service(8), which knows about both.  The
+ * optional mapping file can give a different job name and the pidfile
+ * to watch:
+ *
+ *   [apache.service]
+ *   Name=apache2
+ *   PidFile=/run/apache2/apache2.pid
+ *
+ * Without a PidFile, /run/NAME.pid and /run/NAME/NAME.pid are tried.
+ */
+typedef struct
+{
+  Unit parent_instance;
+
+  gchar *job;
+  gchar *pidfile;
+  gboolean upstart;
+
+  /* The pid last read from the pidfile, good for as long as the file
+   * stays the same.
+   */
+  gchar *cached_path;
+  gint64 cached_mtime;
+  guint64 cached_ino;
+  GPid cached_pid;
+
+  /* The last 'initctl status', for upstart jobs without a pidfile */
+  gint64 status_time;
+  gboolean status_running;
+
+  /* Start and stop requests, in order: the ones at the head, all of
+   * the same kind, are waiting for the operation in progress; see
+   * service_unit_queue().
+   */
+  GQueue pending;
+} ServiceUnit;
+
+typedef UnitClass ServiceUnitClass;
+static GType service_unit_get_type (void);
+
+G_DEFINE_TYPE (ServiceUnit, service_unit, UNIT_TYPE)
+
+static GKeyFile *
+service_unit_get_mapping (void)
+{
+  static GKeyFile *key_file;
+
+  if (!key_file)
+    {
+      /* The file is optional: NAME.service means NAME otherwise */
+      key_file = g_key_file_new ();
+      g_key_file_load_from_file (key_file, SERVICES_FILENAME, G_KEY_FILE_NONE, NULL);
+    }
+
+  return key_file;
+}
+
+static void
+service_unit_invalidate (ServiceUnit *su)
+{
+  g_clear_pointer (&su->cached_path, g_free);
+  su->status_time = 0;
+}
+
+static gboolean
+service_unit_pid_alive (GPid pid)
+{
+  return pid > 0 && (kill (pid, 0) == 0 || errno == EPERM);
+}
+
+static gboolean
+service_unit_check_pidfile (ServiceUnit *su,
+                            const gchar *path,
+                            gboolean    *running)
+{
+  GStatBuf buf;
+
+  if (g_stat (path, &buf) != 0)
+    return FALSE;
+
+  if (g_strcmp0 (su->cached_path, path) != 0 ||
+      su->cached_mtime != (gint64) buf.st_mtime || su->cached_ino != (guint64) buf.st_ino)
+    {
+      gchar *contents;
+
+      su->cached_pid = 0;
+
+      if (g_file_get_contents (path, &contents, NULL, NULL))
+        {
+          su->cached_pid = (GPid) g_ascii_strtoll (contents, NULL, 10);
+          g_free (contents);
+        }
+
+      g_free (su->cached_path);
+      su->cached_path = g_strdup (path);
+      su->cached_mtime = buf.st_mtime;
+      su->cached_ino = buf.st_ino;
+    }
+
+  *running = service_unit_pid_alive (su->cached_pid);
+
+  return TRUE;
+}
+
+static gboolean
+service_unit_upstart_running (ServiceUnit *su)
+{
+  gint64 now = g_get_monotonic_time ();
+
+  if (su->status_time == 0 || now - su->status_time > STATUS_CACHE_USEC)
+    {
+      const gchar *argv[] = { "/sbin/initctl", "status", su->job, NULL };
+      gchar *output = NULL;
+      gint status;
+
+      su->status_running = FALSE;
+
+      if (g_spawn_sync (NULL, (gchar **) argv, NULL, G_SPAWN_STDERR_TO_DEV_NULL,
+                        NULL, NULL, &output, NULL, &status, NULL) &&
+          g_spawn_check_exit_status (status, NULL))
+        su->status_running = output && strstr (output, "start/") != NULL;
+
+      su->status_time = now;
+      g_free (output);
+    }
+
+  return su->status_running;
+}
+
+/* The same idea as status_of_proc in the init scripts, without running
+ * them: a pid from the pidfile that is still alive.
+ */
+static gboolean
+service_unit_is_running (ServiceUnit *su)
+{
+  gboolean running;
+
+  if (su->pidfile)
+    {
+      if (service_unit_check_pidfile (su, su->pidfile, &running))
+        return running;
+    }
+  else
+    {
+      gchar *paths[2];
+      gboolean found;
+      guint i;
+
+      paths[0] = g_strdup_printf ("/run/%s.pid", su->job);
+      paths[1] = g_strdup_printf ("/run/%s/%s.pid", su->job, su->job);
+
+      for (i = 0, found = FALSE; i < G_N_ELEMENTS (paths) && !found; i++)
+        found = service_unit_check_pidfile (su, paths[i], &running);
+
+      for (i = 0; i < G_N_ELEMENTS (paths); i++)
+        g_free (paths[i]);
+
+      if (found)
+        return running;
+    }
+
+  if (su->upstart)
+    return service_unit_upstart_running (su);
+
+  return FALSE;
+}
+
+#define SERVICE_TASK_IS_START(task) GPOINTER_TO_INT (g_task_get_task_data (task))
+
+static void service_unit_run (ServiceUnit *su);
+
+/* Returns the requests that the operation that just finished was for,
+ * and moves on to the next one, if anybody asked for it meanwhile.
+ */
+static void
+service_unit_operation_done (ServiceUnit *su,
+                             gboolean     start)
+{
+  GTask *task;
+
+  while ((task = g_queue_peek_head (&su->pending)) && SERVICE_TASK_IS_START (task) == start)
+    {
+      g_queue_pop_head (&su->pending);
+      g_task_return_boolean (task, TRUE);
+      g_object_unref (task);
+    }
+
+  if (!g_queue_is_empty (&su->pending))
+    service_unit_run (su);
+}
+
+typedef struct
+{
+  ServiceUnit *su;
+  gboolean start;
+} ServiceOperation;
+
+static void
+service_unit_child_exited (GPid     pid,
+                           gint     status,
+                           gpointer user_data)
+{
+  ServiceOperation *op = user_data;
+  ServiceUnit *su = op->su;
+  GError *error = NULL;
+  gboolean success;
+
+  success = g_spawn_check_exit_status (status, &error);
+
+  if (!success)
+    {
+      g_warning ("Error while running 'service %s %s': %s", su->job,
+                 op->start ? "start" : "stop", error->message);
+      g_error_free (error);
+    }
+
+  g_spawn_close_pid (pid);
+
+  SHIM_PROBE2 (service_done, su->job, success);
+
+  service_unit_invalidate (su);
+
+  if (!success)
+    unit_set_active_state ((Unit *) su, UNIT_FAILED, "failed");
+  else if (op->start)
+    unit_set_active_state ((Unit *) su, UNIT_ACTIVE, "running");
+  else
+    unit_set_active_state ((Unit *) su, UNIT_INACTIVE, "dead");
+
+  service_unit_operation_done (su, op->start);
+
+  g_object_unref (su);
+  g_slice_free (ServiceOperation, op);
+}
+
+/* Runs 'service JOB start|stop' without blocking the main loop */
+static gboolean
+service_unit_spawn (ServiceUnit *su,
+                    gboolean     start)
+{
+  const gchar *argv[] = { "/usr/sbin/service", su->job, start ? "start" : "stop", NULL };
+  ServiceOperation *op;
+  GError *error = NULL;
+  GPid pid;
+
+  SHIM_PROBE2 (service_exec, su->job, start);
+
+  if (!g_spawn_async (NULL, (gchar **) argv, NULL, G_SPAWN_DO_NOT_REAP_CHILD, NULL, NULL, &pid, &error))
+    {
+      g_warning ("Error while running 'service %s %s': %s", su->job,
+                 start ? "start" : "stop", error->message);
+      g_error_free (error);
+      return FALSE;
+    }
+
+  op = g_slice_new (ServiceOperation);
+  op->su = g_object_ref (su);
+  op->start = start;
+  g_child_watch_add (pid, service_unit_child_exited, op);
+
+  return TRUE;
+}
+
+static void
+service_unit_load (Unit *unit)
+{
+  ServiceUnit *su = (ServiceUnit *) unit;
+
+  if (service_unit_is_running (su))
+    {
+      unit->active_state = UNIT_ACTIVE;
+      unit->sub_state = "running";
+    }
+}
+
+/* Runs the operation that the request at the head of the queue is for */
+static void
+service_unit_run (ServiceUnit *su)
+{
+  gboolean start;
+
+  start = SERVICE_TASK_IS_START (g_queue_peek_head (&su->pending));
+
+  if (start)
+    unit_set_active_state ((Unit *) su, UNIT_ACTIVATING, "start");
+  else
+    unit_set_active_state ((Unit *) su, UNIT_DEACTIVATING, "stop");
+
+  if (!service_unit_spawn (su, start))
+    {
+      unit_set_active_state ((Unit *) su, UNIT_FAILED, "failed");
+      service_unit_operation_done (su, start);
+    }
+}
+
+/* Starts and stops run one at a time, in the order they were asked
+ * for, so that the last one asked for decides the state we end up in.
+ * A request for the same thing as the one in progress, with nothing
+ * else asked for since, just waits for that.
+ */
+static void
+service_unit_queue (ServiceUnit *su,
+                    GTask       *task,
+                    gboolean     start)
+{
+  gboolean in_progress;
+
+  in_progress = !g_queue_is_empty (&su->pending);
+  g_task_set_task_data (task, GINT_TO_POINTER (start), NULL);
+  g_queue_push_tail (&su->pending, task);
+
+  if (!in_progress)
+    service_unit_run (su);
+}
+
+static void
+service_unit_start_async (Unit  *unit,
+                          GTask *task)
+{
+  service_unit_queue ((ServiceUnit *) unit, task, TRUE);
+}
+
+static void
+service_unit_stop_async (Unit  *unit,
+                         GTask *task)
+{
+  service_unit_queue ((ServiceUnit *) unit, task, FALSE);
+}
+
+/* The job's entry in the unit file index, which might be under another
+ * name than ours if the mapping file says so.
+ */
+static const gchar *
+service_unit_get_state (Unit *unit)
+{
+  ServiceUnit *su = (ServiceUnit *) unit;
+  const gchar *state;
+  gchar *name;
+
+  name = g_strconcat (su->job, ".service", NULL);
+  state = unit_files_get_state (name);
+  g_free (name);
+
+  return state ? state : "disabled";
+}
+
+Unit *
+service_unit_new (const gchar *unit_name)
+{
+  GKeyFile *mapping;
+  ServiceUnit *su;
+  gchar *pidfile;
+  gboolean upstart;
+  gchar *path;
+  gchar *job;
+
+  g_return_val_if_fail (g_str_has_suffix (unit_name, ".service"), NULL);
+
+  mapping = service_unit_get_mapping ();
+  job = g_key_file_get_string (mapping, unit_name, "Name", NULL);
+  if (!job)
+    job = g_strndup (unit_name, strlen (unit_name) - strlen (".service"));
+
+  /* The name comes from our callers: keep it inside /etc/init{,.d} */
+  if (!job[0] || job[0] == '.' || strchr (job, '/'))
+    {
+      g_free (job);
+      return NULL;
+    }
+
+  path = g_strdup_printf ("/etc/init/%s.conf", job);
+  upstart = g_file_test (path, G_FILE_TEST_EXISTS);
+  g_free (path);
+
+  if (!upstart)
+    {
+      path = g_strdup_printf ("/etc/init.d/%s", job);
+      if (!g_file_test (path, G_FILE_TEST_IS_EXECUTABLE))
+        {
+          g_free (path);
+          g_free (job);
+          return NULL;
+        }
+      g_free (path);
+    }
+
+  pidfile = g_key_file_get_string (mapping, unit_name, "PidFile", NULL);
+
+  su = g_object_new (service_unit_get_type (), NULL);
+  su->job = job;
+  su->pidfile = pidfile;
+  su->upstart = upstart;
+
+  return (Unit *) su;
+}
+
+static void
+service_unit_finalize (GObject *object)
+{
+  ServiceUnit *su = (ServiceUnit *) object;
+
+  g_free (su->job);
+  g_free (su->pidfile);
+  g_free (su->cached_path);
+
+  G_OBJECT_CLASS (service_unit_parent_class)->finalize (object);
+}
+
+static void
+service_unit_init (ServiceUnit *su)
+{
+}
+
+static void
+service_unit_class_init (UnitClass *class)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (class);
+
+  object_class->finalize = service_unit_finalize;
+
+  class->load = service_unit_load;
+  class->start_async = service_unit_start_async;
+  class->stop_async = service_unit_stop_async;
+  class->get_state = service_unit_get_state;
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright © 2014 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#include "settings.h"
+
+#define SETTINGS_FILENAME SYSCONFDIR "/systemd-shim.conf"
+
+static GKeyFile *
+settings_get_key_file (void)
+{
+  static GKeyFile *key_file;
+
+  if (!key_file)
+    {
+      /* The file is optional: everything has a built-in default */
+      key_file = g_key_file_new ();
+      g_key_file_load_from_file (key_file, SETTINGS_FILENAME, G_KEY_FILE_NONE, NULL);
+    }
+
+  return key_file;
+}
+
+gint
+settings_get_int (const gchar *group,
+                  const gchar *key,
+                  gint         default_value)
+{
+  GError *error = NULL;
+  gint value;
+
+  value = g_key_file_get_integer (settings_get_key_file (), group, key, &error);
+
+  if (error)
+    {
+      if (!g_error_matches (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_GROUP_NOT_FOUND) &&
+          !g_error_matches (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_KEY_NOT_FOUND))
+        g_warning ("Ignoring %s setting %s.%s: %s", SETTINGS_FILENAME, group, key, error->message);
+
+      g_error_free (error);
+
+      return default_value;
+    }
+
+  return value;
+}
+
+gboolean
+settings_get_boolean (const gchar *group,
+                      const gchar *key,
+                      gboolean     default_value)
+{
+  GError *error = NULL;
+  gboolean value;
+
+  value = g_key_file_get_boolean (settings_get_key_file (), group, key, &error);
+
+  if (error)
+    {
+      if (!g_error_matches (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_GROUP_NOT_FOUND) &&
+          !g_error_matches (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_KEY_NOT_FOUND))
+        g_warning ("Ignoring %s setting %s.%s: %s", SETTINGS_FILENAME, group, key, error->message);
+
+      g_error_free (error);
+
+      return default_value;
+    }
+
+  return value;
+}
+
+gchar *
+settings_get_string (const gchar *group,
+                     const gchar *key,
+                     const gchar *default_value)
+{
+  gchar *value;
+
+  value = g_key_file_get_string (settings_get_key_file (), group, key, NULL);
+
+  if (!value)
+    value = g_strdup (default_value);
+
+  return value;
+}
@@ -0,0 +1,37 @@
+/*
+ * Copyright © 2014 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#ifndef _settings_h_
+#define _settings_h_
+
+#include <glib.h>
+
+gint settings_get_int (const gchar *group,
+                       const gchar *key,
+                       gint         default_value);
+
+gboolean settings_get_boolean (const gchar *group,
+                               const gchar *key,
+                               gboolean     default_value);
+
+gchar * settings_get_string (const gchar *group,
+                             const gchar *key,
+                             const gchar *default_value);
+
+#endif /* _settings_h_ */
@@ -0,0 +1,546 @@
+/*
+ * Copyright © 2014 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#include "sleep.h"
+#include "power-history.h"
+#include "probes.h"
+#include "settings.h"
+
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#define SLEEP_STATE_FILENAME     "/sys/power/state"
+#define SLEEP_DISK_FILENAME      "/sys/power/disk"
+#define SLEEP_WAKEALARM_FILENAME "/sys/class/rtc/rtc0/wakealarm"
+
+/* Our own take on what pm-utils does: run the hooks in the hooks
+ * directory as "<hook> pre <verb>", write to /sys/power/state, then run
+ * them again as "<hook> post <verb>", which is also the interface of
+ * systemd's system-sleep hooks.
+ *
+ * Unlike pm-utils, all hooks of a phase run in parallel, and one that
+ * takes longer than HookTimeoutSec gets killed.  A failing hook is
+ * logged and otherwise ignored.
+ *
+ * Hybrid sleep writes the hibernation image and then suspends instead
+ * of powering off.  Suspend-then-hibernate suspends with the RTC alarm
+ * set HibernateDelaySec ahead and, if it was the alarm that woke us up,
+ * goes on to hibernate.
+ */
+
+static const gchar * const sleep_mode_verbs[] = {
+  [SLEEP_SUSPEND] = "suspend",
+  [SLEEP_HIBERNATE] = "hibernate",
+  [SLEEP_HYBRID_SLEEP] = "hybrid-sleep",
+  [SLEEP_SUSPEND_THEN_HIBERNATE] = "suspend-then-hibernate"
+};
+
+typedef struct
+{
+  SleepMode mode;
+  const gchar *verb;
+  guint hibernate_delay;
+
+  /* How long we spent in each phase, in microseconds */
+  gint64 pre_hooks_usec;
+  gint64 suspend_usec;
+  gint64 hibernate_usec;
+  gint64 post_hooks_usec;
+
+  /* CLOCK_REALTIME: the first time we went down and the last time we
+   * came back
+   */
+  gint64 kernel_entered;
+  gint64 resumed;
+
+  const gchar *phase;
+  gint64 phase_start;
+  guint hooks_running;
+  gboolean success;
+  GError *error;
+  void (* hooks_done) (GTask *task);
+} SleepOperation;
+
+typedef struct
+{
+  GTask *task;
+  gchar *path;
+  GPid pid;
+  gint64 start_time;
+  guint timeout_id;
+} SleepHook;
+
+static void
+sleep_operation_free (gpointer data)
+{
+  SleepOperation *op = data;
+
+  if (op->error)
+    g_error_free (op->error);
+
+  g_slice_free (SleepOperation, op);
+}
+
+static void
+sleep_hooks_finished (GTask *task)
+{
+  SleepOperation *op = g_task_get_task_data (task);
+  gint64 elapsed;
+
+  elapsed = g_get_monotonic_time () - op->phase_start;
+
+  if (g_str_equal (op->phase, "pre"))
+    {
+      op->pre_hooks_usec = elapsed;
+      power_history_mark (POWER_PHASE_HOOKS_FINISHED, g_get_real_time ());
+    }
+  else
+    {
+      op->post_hooks_usec = elapsed;
+      power_history_mark (POWER_PHASE_RESUME_HOOKS_FINISHED, g_get_real_time ());
+    }
+
+  op->hooks_done (task);
+}
+
+static void
+sleep_hook_exited (GPid     pid,
+                   gint     status,
+                   gpointer user_data)
+{
+  SleepHook *hook = user_data;
+  SleepOperation *op = g_task_get_task_data (hook->task);
+  GError *error = NULL;
+  gint64 elapsed;
+
+  elapsed = g_get_monotonic_time () - hook->start_time;
+  SHIM_PROBE2 (sleep_hook, hook->path, elapsed);
+
+  if (hook->timeout_id)
+    g_source_remove (hook->timeout_id);
+
+  if (!g_spawn_check_exit_status (status, &error))
+    {
+      g_warning ("Sleep hook '%s %s %s' failed: %s", hook->path, op->phase, op->verb, error->message);
+      g_error_free (error);
+    }
+
+  /* Slow hooks are what this is all about, so make them easy to spot */
+  if (elapsed >= G_TIME_SPAN_SECOND)
+    g_message ("Sleep hook '%s %s %s' took %" G_GINT64_FORMAT "ms",
+               hook->path, op->phase, op->verb, elapsed / 1000);
+  else
+    g_debug ("Sleep hook '%s %s %s' took %" G_GINT64_FORMAT "ms",
+             hook->path, op->phase, op->verb, elapsed / 1000);
+
+  g_spawn_close_pid (pid);
+
+  if (--op->hooks_running == 0)
+    sleep_hooks_finished (hook->task);
+
+  g_free (hook->path);
+  g_slice_free (SleepHook, hook);
+}
+
+static gboolean
+sleep_hook_timed_out (gpointer user_data)
+{
+  SleepHook *hook = user_data;
+
+  g_warning ("Sleep hook '%s' timed out; killing it", hook->path);
+
+  /* Along with anything it started, so that nothing is left running
+   * across the suspend.
+   */
+  kill (-hook->pid, SIGKILL);
+  hook->timeout_id = 0;
+
+  /* sleep_hook_exited() takes it from here */
+  return FALSE;
+}
+
+/* Runs in the child: each hook gets a process group of its own */
+static void
+sleep_hook_setup (gpointer user_data)
+{
+  setpgid (0, 0);
+}
+
+static void
+sleep_run_hooks (GTask        *task,
+                 const gchar  *phase,
+                 void        (* hooks_done) (GTask *task))
+{
+  SleepOperation *op = g_task_get_task_data (task);
+  const gchar *name;
+  gchar *hooks_dir;
+  guint timeout;
+  GDir *dir;
+
+  op->phase = phase;
+  op->phase_start = g_get_monotonic_time ();
+  op->hooks_done = hooks_done;
+
+  if (g_str_equal (phase, "pre"))
+    power_history_mark (POWER_PHASE_HOOKS_STARTED, g_get_real_time ());
+
+  hooks_dir = settings_get_string ("Sleep", "HooksDirectory", "/lib/systemd/system-sleep");
+  timeout = MAX (settings_get_int ("Sleep", "HookTimeoutSec", 10), 1);
+
+  /* Hold off finishing until all hooks have been started */
+  op->hooks_running = 1;
+
+  dir = g_dir_open (hooks_dir, 0, NULL);
+
+  while (dir && (name = g_dir_read_name (dir)))
+    {
+      GError *error = NULL;
+      SleepHook *hook;
+      gchar *argv[4];
+      GPid pid;
+
+      argv[0] = g_build_filename (hooks_dir, name, NULL);
+      argv[1] = (gchar *) phase;
+      argv[2] = (gchar *) op->verb;
+      argv[3] = NULL;
+
+      if (g_file_test (argv[0], G_FILE_TEST_IS_DIR) || !g_file_test (argv[0], G_FILE_TEST_IS_EXECUTABLE))
+        {
+          g_free (argv[0]);
+          continue;
+        }
+
+      if (!g_spawn_async (NULL, argv, NULL, G_SPAWN_DO_NOT_REAP_CHILD, sleep_hook_setup, NULL, &pid, &error))
+        {
+          g_warning ("Unable to run sleep hook '%s': %s", argv[0], error->message);
+          g_error_free (error);
+          g_free (argv[0]);
+          continue;
+        }
+
+      /* Also from here, so that the group exists whichever of us gets to
+       * run first.
+       */
+      setpgid (pid, pid);
+
+      hook = g_slice_new (SleepHook);
+      hook->task = task;
+      hook->path = argv[0];
+      hook->pid = pid;
+      hook->start_time = g_get_monotonic_time ();
+      hook->timeout_id = g_timeout_add_seconds (timeout, sleep_hook_timed_out, hook);
+      g_child_watch_add (pid, sleep_hook_exited, hook);
+      op->hooks_running++;
+    }
+
+  if (dir)
+    g_dir_close (dir);
+
+  g_free (hooks_dir);
+
+  if (--op->hooks_running == 0)
+    sleep_hooks_finished (task);
+}
+
+static void
+sleep_post_hooks_done (GTask *task)
+{
+  SleepOperation *op = g_task_get_task_data (task);
+
+  g_message ("%s: pre hooks %" G_GINT64_FORMAT "ms, suspended %" G_GINT64_FORMAT "ms, "
+             "hibernated %" G_GINT64_FORMAT "ms, post hooks %" G_GINT64_FORMAT "ms",
+             op->verb, op->pre_hooks_usec / 1000, op->suspend_usec / 1000,
+             op->hibernate_usec / 1000, op->post_hooks_usec / 1000);
+
+  if (op->success)
+    g_task_return_boolean (task, TRUE);
+  else
+    g_task_return_error (task, g_error_copy (op->error));
+
+  g_object_unref (task);
+}
+
+static void
+sleep_state_written (GObject      *source_object,
+                     GAsyncResult *result,
+                     gpointer      user_data)
+{
+  GTask *task = user_data;
+  SleepOperation *op = g_task_get_task_data (task);
+
+  op->success = g_task_propagate_boolean (G_TASK (result), &op->error);
+  SHIM_PROBE2 (sleep_resumed, op->verb, op->success);
+
+  if (op->kernel_entered)
+    power_history_mark (POWER_PHASE_KERNEL_ENTERED, op->kernel_entered);
+  if (op->resumed)
+    power_history_mark (POWER_PHASE_RESUMED, op->resumed);
+
+  sleep_run_hooks (task, "post", sleep_post_hooks_done);
+}
+
+static gboolean
+sleep_write_file (const gchar  *filename,
+                  const gchar  *value,
+                  GError      **error)
+{
+  gint saved_errno;
+  gssize written;
+  gint fd;
+
+  fd = open (filename, O_WRONLY | O_CLOEXEC);
+  if (fd == -1)
+    {
+      saved_errno = errno;
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                   "Could not open %s: %s", filename, g_strerror (saved_errno));
+      return FALSE;
+    }
+
+  written = write (fd, value, strlen (value));
+  saved_errno = errno;
+  close (fd);
+
+  if (written != strlen (value))
+    {
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                   "Failed to write '%s' to %s: %s", value, filename, g_strerror (saved_errno));
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* /sys/power/disk lists all modes, with the current one in brackets */
+static gchar *
+sleep_get_disk_mode (void)
+{
+  gchar *contents;
+  gchar *start;
+  gchar *end;
+  gchar *mode = NULL;
+
+  if (!g_file_get_contents (SLEEP_DISK_FILENAME, &contents, NULL, NULL))
+    return NULL;
+
+  if ((start = strchr (contents, '[')) && (end = strchr (start, ']')))
+    mode = g_strndup (start + 1, end - start - 1);
+
+  g_free (contents);
+
+  return mode;
+}
+
+static gboolean
+sleep_suspend (SleepOperation  *op,
+               GError         **error)
+{
+  gboolean success;
+  gint64 start;
+
+  if (!op->kernel_entered)
+    op->kernel_entered = g_get_real_time ();
+
+  start = g_get_monotonic_time ();
+  success = sleep_write_file (SLEEP_STATE_FILENAME, "mem", error);
+  op->suspend_usec += g_get_monotonic_time () - start;
+
+  op->resumed = g_get_real_time ();
+
+  return success;
+}
+
+/* With 'disk_mode' "suspend", this is hybrid sleep */
+static gboolean
+sleep_hibernate (SleepOperation  *op,
+                 const gchar     *disk_mode,
+                 GError         **error)
+{
+  gchar *saved_mode = NULL;
+  gboolean success;
+  gint64 start;
+
+  if (disk_mode)
+    {
+      saved_mode = sleep_get_disk_mode ();
+
+      if (!sleep_write_file (SLEEP_DISK_FILENAME, disk_mode, error))
+        {
+          g_free (saved_mode);
+          return FALSE;
+        }
+    }
+
+  if (!op->kernel_entered)
+    op->kernel_entered = g_get_real_time ();
+
+  start = g_get_monotonic_time ();
+  success = sleep_write_file (SLEEP_STATE_FILENAME, "disk", error);
+  op->hibernate_usec += g_get_monotonic_time () - start;
+
+  op->resumed = g_get_real_time ();
+
+  if (saved_mode)
+    sleep_write_file (SLEEP_DISK_FILENAME, saved_mode, NULL);
+
+  g_free (saved_mode);
+
+  return success;
+}
+
+/* The kernel clears the alarm once it has gone off */
+static gboolean
+sleep_wakealarm_fired (void)
+{
+  gchar *contents;
+  gboolean fired;
+
+  if (!g_file_get_contents (SLEEP_WAKEALARM_FILENAME, &contents, NULL, NULL))
+    return FALSE;
+
+  fired = g_strstrip (contents)[0] == '\0';
+  g_free (contents);
+
+  return fired;
+}
+
+static gboolean
+sleep_suspend_then_hibernate (SleepOperation  *op,
+                              GError         **error)
+{
+  GError *local_error = NULL;
+  gchar *alarm;
+  gboolean armed;
+
+  alarm = g_strdup_printf ("+%u", op->hibernate_delay);
+  armed = sleep_write_file (SLEEP_WAKEALARM_FILENAME, "0", &local_error) &&
+          sleep_write_file (SLEEP_WAKEALARM_FILENAME, alarm, &local_error);
+  g_free (alarm);
+
+  if (!armed)
+    {
+      g_warning ("Unable to set the RTC alarm, only suspending: %s", local_error->message);
+      g_error_free (local_error);
+    }
+
+  if (!sleep_suspend (op, error))
+    return FALSE;
+
+  if (!armed)
+    return TRUE;
+
+  /* Woken up some other way: the user is back, so stay up */
+  if (!sleep_wakealarm_fired ())
+    {
+      sleep_write_file (SLEEP_WAKEALARM_FILENAME, "0", NULL);
+      return TRUE;
+    }
+
+  g_debug ("Suspended for %us, hibernating", op->hibernate_delay);
+
+  return sleep_hibernate (op, NULL, error);
+}
+
+/* Runs in a worker thread: only returns after resume */
+static void
+sleep_enter (GTask        *task,
+             gpointer      source_object,
+             gpointer      task_data,
+             GCancellable *cancellable)
+{
+  SleepOperation *op = task_data;
+  GError *error = NULL;
+  gboolean success = FALSE;
+
+  switch (op->mode)
+    {
+    case SLEEP_SUSPEND:
+      success = sleep_suspend (op, &error);
+      break;
+
+    case SLEEP_HIBERNATE:
+      success = sleep_hibernate (op, NULL, &error);
+      break;
+
+    case SLEEP_HYBRID_SLEEP:
+      success = sleep_hibernate (op, "suspend", &error);
+      break;
+
+    case SLEEP_SUSPEND_THEN_HIBERNATE:
+      success = sleep_suspend_then_hibernate (op, &error);
+      break;
+
+    default:
+      g_assert_not_reached ();
+    }
+
+  if (success)
+    g_task_return_boolean (task, TRUE);
+  else
+    g_task_return_error (task, error);
+}
+
+static void
+sleep_pre_hooks_done (GTask *task)
+{
+  SleepOperation *op = g_task_get_task_data (task);
+  GTask *write_task;
+
+  SHIM_PROBE1 (sleep_enter, op->verb);
+
+  /* 'op' belongs to 'task', which outlives this one */
+  write_task = g_task_new (NULL, NULL, sleep_state_written, task);
+  g_task_set_task_data (write_task, op, NULL);
+  g_task_run_in_thread (write_task, sleep_enter);
+  g_object_unref (write_task);
+}
+
+/* Completes after resume, once the post hooks have finished */
+void
+sleep_run_async (SleepMode            mode,
+                 GAsyncReadyCallback  callback,
+                 gpointer             user_data)
+{
+  SleepOperation *op;
+  GTask *task;
+
+  g_return_if_fail (mode < N_SLEEP_MODES);
+
+  op = g_slice_new0 (SleepOperation);
+  op->mode = mode;
+  op->verb = sleep_mode_verbs[mode];
+  op->hibernate_delay = MAX (settings_get_int ("Sleep", "HibernateDelaySec", 7200), 1);
+
+  task = g_task_new (NULL, NULL, callback, user_data);
+  g_task_set_task_data (task, op, sleep_operation_free);
+
+  sleep_run_hooks (task, "pre", sleep_pre_hooks_done);
+}
+
+gboolean
+sleep_run_finish (GAsyncResult  *result,
+                  GError       **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, NULL), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
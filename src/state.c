@@ -18,6 +18,9 @@
  */
 
 #include "state.h"
+#include "probes.h"
+#include "stats.h"
+#include "trace.h"
 
 #define STATE_FILENAME "/run/systemd-shim-state"
 
@@ -40,15 +43,60 @@ state_sync (void)
 {
   GError *error = NULL;
   GKeyFile *key_file;
+  gchar *contents;
+  gsize length;
+  gint64 start;
+
+  start = g_get_monotonic_time ();
 
   key_file = state_get_key_file ();
+  contents = g_key_file_to_data (key_file, &length, NULL);
+  SHIM_PROBE1 (state_sync_begin, length);
 
   /* This will be world-readable but that's OK */
-  if (!g_key_file_save_to_file (key_file, STATE_FILENAME, &error))
+  if (!g_file_set_contents (STATE_FILENAME, contents, length, &error))
     {
       g_warning ("cannot save systemd-shim state: %s", error->message);
       g_error_free (error);
     }
+
+  stats_record_state_write (length, g_get_monotonic_time () - start);
+  SHIM_PROBE2 (state_sync_end, length, g_get_monotonic_time () - start);
+  trace_add_time (TRACE_PHASE_STATE, g_get_monotonic_time () - start);
+  g_free (contents);
+}
+
+/* Changes made between state_freeze() and state_thaw() are written out
+ * together, once, when the outermost freeze is thawed.
+ */
+static guint state_freeze_count;
+static gboolean state_dirty;
+
+static void
+state_changed (void)
+{
+  if (state_freeze_count)
+    state_dirty = TRUE;
+  else
+    state_sync ();
+}
+
+void
+state_freeze (void)
+{
+  state_freeze_count++;
+}
+
+void
+state_thaw (void)
+{
+  g_return_if_fail (state_freeze_count > 0);
+
+  if (--state_freeze_count == 0 && state_dirty)
+    {
+      state_dirty = FALSE;
+      state_sync ();
+    }
 }
 
 gchar **
@@ -76,7 +124,17 @@ state_set_string (const gchar *unit,
   GKeyFile *key_file = state_get_key_file ();
 
   g_key_file_set_string (key_file, unit, key, value);
-  state_sync ();
+  state_changed ();
+}
+
+void
+state_remove_key (const gchar *unit,
+                  const gchar *key)
+{
+  GKeyFile *key_file = state_get_key_file ();
+
+  g_key_file_remove_key (key_file, unit, key, NULL);
+  state_changed ();
 }
 
 void
@@ -85,5 +143,5 @@ state_remove_unit (const gchar *unit)
   GKeyFile *key_file = state_get_key_file ();
 
   g_key_file_remove_group (key_file, unit, NULL);
-  state_sync ();
+  state_changed ();
 }
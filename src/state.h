@@ -31,6 +31,13 @@ void state_set_string (const gchar *unit,
                        const gchar *key,
                        const gchar *value);
 
+void state_remove_key (const gchar *unit,
+                       const gchar *key);
+
 void state_remove_unit (const gchar *unit);
 
+void state_freeze (void);
+
+void state_thaw (void);
+
 #endif /* _state_h_ */
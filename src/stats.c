@@ -0,0 +1,262 @@
+/*
+ * Copyright © 2014 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#include "stats.h"
+
+#include <string.h>
+
+/* Everything in here is a fixed-size static array so that recording a
+ * sample is a name lookup in a short table and a few increments: no
+ * locking and no allocation.  All recording happens from the main
+ * thread, except for the cgmanager setup thread, which finishes before
+ * the main thread makes its first cgmanager call.
+ *
+ * Latency histograms are log2-bucketed: bucket 0 counts samples below
+ * 2us and bucket i counts samples in [2^i, 2^(i+1)) microseconds.  The
+ * last bucket also takes everything above ~8 seconds.
+ */
+#define STATS_N_BUCKETS 24
+
+typedef struct
+{
+  guint64 count;
+  guint64 errors;
+  guint64 total_usec;
+  guint64 max_usec;
+  guint64 buckets[STATS_N_BUCKETS];
+} StatsHistogram;
+
+/* Each table ends with an "other" slot for names that are not listed */
+static const gchar * const stats_method_names[] = {
+  "GetUnitFileState", "EnableUnitFiles", "DisableUnitFiles", "Reload",
+  "GetUnit", "LoadUnit", "ListUnits",
+  "StartUnit", "StopUnit", "StartTransientUnit",
+  "Subscribe", "Unsubscribe",
+  "Abandon",
+  "StartTransientUnits", "StopUnits",
+  "ListUnitFiles",
+  "other"
+};
+
+static const gchar * const stats_unit_type_names[] = {
+  "scope", "slice", "target", "service", "other"
+};
+
+static const gchar * const stats_request_class_names[] = {
+  "power", "session", "default", "teardown", "other"
+};
+
+static const gchar * const stats_backend_names[] = {
+  "Create", "Chown", "MovePid", "MovePidAbs", "SetValue", "GetValue",
+  "Remove", "Prune", "GetTasksRecursive",
+  "other"
+};
+
+static StatsHistogram stats_methods[G_N_ELEMENTS (stats_method_names)];
+static StatsHistogram stats_unit_types[G_N_ELEMENTS (stats_unit_type_names)];
+static StatsHistogram stats_backend[G_N_ELEMENTS (stats_backend_names)];
+static StatsHistogram stats_queue_wait[G_N_ELEMENTS (stats_request_class_names)];
+static guint64 stats_throttled[G_N_ELEMENTS (stats_method_names)];
+static StatsHistogram stats_state_writes;
+static guint64 stats_state_write_bytes;
+
+static guint64 stats_activations;
+static gint64 stats_start_time;
+
+static guint
+stats_lookup (const gchar * const *names,
+              guint                n_names,
+              const gchar         *name)
+{
+  guint i;
+
+  for (i = 0; i < n_names - 1; i++)
+    if (strcmp (names[i], name) == 0)
+      break;
+
+  return i;
+}
+
+static void
+stats_histogram_add (StatsHistogram *histogram,
+                     gboolean        failed,
+                     gint64          usec)
+{
+  guint bucket;
+
+  if (usec < 0)
+    usec = 0;
+
+  bucket = usec > 1 ? g_bit_storage (usec) - 1 : 0;
+  if (bucket >= STATS_N_BUCKETS)
+    bucket = STATS_N_BUCKETS - 1;
+
+  histogram->count++;
+  histogram->errors += failed ? 1 : 0;
+  histogram->total_usec += usec;
+  histogram->max_usec = MAX (histogram->max_usec, (guint64) usec);
+  histogram->buckets[bucket]++;
+}
+
+void
+stats_record_request (const gchar *method_name,
+                      const gchar *unit_name,
+                      gboolean     failed,
+                      gint64       usec)
+{
+  guint index;
+
+  index = stats_lookup (stats_method_names, G_N_ELEMENTS (stats_method_names), method_name);
+  stats_histogram_add (&stats_methods[index], failed, usec);
+
+  if (unit_name)
+    {
+      const gchar *dot;
+
+      dot = strrchr (unit_name, '.');
+      index = stats_lookup (stats_unit_type_names, G_N_ELEMENTS (stats_unit_type_names), dot ? dot + 1 : "");
+      stats_histogram_add (&stats_unit_types[index], failed, usec);
+    }
+}
+
+void
+stats_record_backend (const gchar *method_name,
+                      gboolean     failed,
+                      gint64       usec)
+{
+  guint index;
+
+  index = stats_lookup (stats_backend_names, G_N_ELEMENTS (stats_backend_names), method_name);
+  stats_histogram_add (&stats_backend[index], failed, usec);
+}
+
+void
+stats_record_queue_wait (const gchar *class_name,
+                         gint64       usec)
+{
+  guint index;
+
+  index = stats_lookup (stats_request_class_names, G_N_ELEMENTS (stats_request_class_names), class_name);
+  stats_histogram_add (&stats_queue_wait[index], FALSE, usec);
+}
+
+void
+stats_record_throttled (const gchar *method_name)
+{
+  stats_throttled[stats_lookup (stats_method_names, G_N_ELEMENTS (stats_method_names), method_name)]++;
+}
+
+void
+stats_record_state_write (gsize  bytes,
+                          gint64 usec)
+{
+  stats_histogram_add (&stats_state_writes, FALSE, usec);
+  stats_state_write_bytes += bytes;
+}
+
+void
+stats_set_activation (guint64 activations,
+                      gint64  start_time)
+{
+  stats_activations = activations;
+  stats_start_time = start_time;
+}
+
+static GVariant *
+stats_histogram_get_variant (const StatsHistogram *histogram)
+{
+  return g_variant_new ("(tttt@at)", histogram->count, histogram->errors,
+                        histogram->total_usec, histogram->max_usec,
+                        g_variant_new_fixed_array (G_VARIANT_TYPE_UINT64, histogram->buckets,
+                                                   STATS_N_BUCKETS, sizeof (guint64)));
+}
+
+static GVariant *
+stats_table_get_variant (const gchar * const  *names,
+                         const StatsHistogram *histograms,
+                         guint                 n_histograms)
+{
+  GVariantBuilder builder;
+  guint i;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{s(ttttat)}"));
+
+  for (i = 0; i < n_histograms; i++)
+    if (histograms[i].count)
+      g_variant_builder_add (&builder, "{s@(ttttat)}", names[i], stats_histogram_get_variant (&histograms[i]));
+
+  return g_variant_builder_end (&builder);
+}
+
+static GVariant *
+stats_throttled_get_variant (void)
+{
+  GVariantBuilder builder;
+  guint i;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{st}"));
+
+  for (i = 0; i < G_N_ELEMENTS (stats_throttled); i++)
+    if (stats_throttled[i])
+      g_variant_builder_add (&builder, "{st}", stats_method_names[i], stats_throttled[i]);
+
+  return g_variant_builder_end (&builder);
+}
+
+/* Histograms are (count, errors, total_usec, max_usec, buckets) */
+GVariant *
+stats_get_variant (void)
+{
+  GVariantBuilder builder;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+
+  g_variant_builder_add (&builder, "{sv}", "Activations", g_variant_new_uint64 (stats_activations));
+  g_variant_builder_add (&builder, "{sv}", "UptimeUSec",
+                         g_variant_new_uint64 (g_get_monotonic_time () - stats_start_time));
+  g_variant_builder_add (&builder, "{sv}", "Methods",
+                         stats_table_get_variant (stats_method_names, stats_methods,
+                                                  G_N_ELEMENTS (stats_methods)));
+  g_variant_builder_add (&builder, "{sv}", "UnitTypes",
+                         stats_table_get_variant (stats_unit_type_names, stats_unit_types,
+                                                  G_N_ELEMENTS (stats_unit_types)));
+  g_variant_builder_add (&builder, "{sv}", "Backend",
+                         stats_table_get_variant (stats_backend_names, stats_backend,
+                                                  G_N_ELEMENTS (stats_backend)));
+  g_variant_builder_add (&builder, "{sv}", "QueueWait",
+                         stats_table_get_variant (stats_request_class_names, stats_queue_wait,
+                                                  G_N_ELEMENTS (stats_queue_wait)));
+  g_variant_builder_add (&builder, "{sv}", "Throttled", stats_throttled_get_variant ());
+  g_variant_builder_add (&builder, "{sv}", "StateWrites", stats_histogram_get_variant (&stats_state_writes));
+  g_variant_builder_add (&builder, "{sv}", "StateWriteBytes", g_variant_new_uint64 (stats_state_write_bytes));
+
+  return g_variant_builder_end (&builder);
+}
+
+void
+stats_reset (void)
+{
+  memset (stats_methods, 0, sizeof stats_methods);
+  memset (stats_unit_types, 0, sizeof stats_unit_types);
+  memset (stats_backend, 0, sizeof stats_backend);
+  memset (stats_queue_wait, 0, sizeof stats_queue_wait);
+  memset (stats_throttled, 0, sizeof stats_throttled);
+  memset (&stats_state_writes, 0, sizeof stats_state_writes);
+  stats_state_write_bytes = 0;
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright © 2014 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#ifndef _stats_h_
+#define _stats_h_
+
+#include <glib.h>
+
+void stats_record_request (const gchar *method_name,
+                           const gchar *unit_name,
+                           gboolean     failed,
+                           gint64       usec);
+
+void stats_record_backend (const gchar *method_name,
+                           gboolean     failed,
+                           gint64       usec);
+
+void stats_record_queue_wait (const gchar *class_name,
+                              gint64       usec);
+
+void stats_record_throttled (const gchar *method_name);
+
+void stats_record_state_write (gsize  bytes,
+                               gint64 usec);
+
+void stats_set_activation (guint64 activations,
+                           gint64  start_time);
+
+GVariant * stats_get_variant (void);
+
+void stats_reset (void);
+
+#endif /* _stats_h_ */
@@ -0,0 +1,184 @@
+/*
+ * Copyright © 2014 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#include "subscribers.h"
+#include "trace.h"
+
+typedef struct
+{
+  GDBusConnection *connection;
+  gchar *name;
+  guint watch_id;
+  gulong closed_id;
+} Subscriber;
+
+/* There are only ever a handful of subscribers (logind, maybe a
+ * systemctl or two) so a flat array is the right thing here.
+ */
+static GPtrArray *subscribers;
+
+static void
+subscriber_free (gpointer data)
+{
+  Subscriber *subscriber = data;
+
+  if (subscriber->watch_id)
+    g_bus_unwatch_name (subscriber->watch_id);
+
+  if (subscriber->closed_id)
+    g_signal_handler_disconnect (subscriber->connection, subscriber->closed_id);
+
+  g_object_unref (subscriber->connection);
+  g_free (subscriber->name);
+
+  g_slice_free (Subscriber, subscriber);
+}
+
+static gint
+subscribers_find (GDBusConnection *connection,
+                  const gchar     *name)
+{
+  guint i;
+
+  if (!subscribers)
+    return -1;
+
+  for (i = 0; i < subscribers->len; i++)
+    {
+      Subscriber *subscriber = g_ptr_array_index (subscribers, i);
+
+      if (subscriber->connection == connection && g_strcmp0 (subscriber->name, name) == 0)
+        return i;
+    }
+
+  return -1;
+}
+
+static void
+subscribers_name_vanished (GDBusConnection *connection,
+                           const gchar     *name,
+                           gpointer         user_data)
+{
+  g_debug ("Subscriber %s went away", name);
+  subscribers_remove (connection, name);
+}
+
+static void
+subscribers_connection_closed (GDBusConnection *connection,
+                               gboolean         remote_peer_vanished,
+                               GError          *error,
+                               gpointer         user_data)
+{
+  g_debug ("Peer subscriber went away");
+  subscribers_remove (connection, NULL);
+}
+
+/* 'name' is NULL for a peer-to-peer connection, in which case the
+ * subscription lasts until the connection is closed.
+ */
+void
+subscribers_add (GDBusConnection *connection,
+                 const gchar     *name)
+{
+  Subscriber *subscriber;
+
+  if (subscribers_find (connection, name) >= 0)
+    return;
+
+  if (!subscribers)
+    subscribers = g_ptr_array_new_with_free_func (subscriber_free);
+
+  g_debug ("Adding subscriber %s", name);
+
+  subscriber = g_slice_new (Subscriber);
+  subscriber->connection = g_object_ref (connection);
+  subscriber->name = g_strdup (name);
+
+  if (name)
+    {
+      subscriber->watch_id = g_bus_watch_name_on_connection (connection, name, G_BUS_NAME_WATCHER_FLAGS_NONE,
+                                                             NULL, subscribers_name_vanished, NULL, NULL);
+      subscriber->closed_id = 0;
+    }
+  else
+    {
+      subscriber->watch_id = 0;
+      subscriber->closed_id = g_signal_connect (connection, "closed",
+                                                G_CALLBACK (subscribers_connection_closed), NULL);
+    }
+
+  g_ptr_array_add (subscribers, subscriber);
+}
+
+void
+subscribers_remove (GDBusConnection *connection,
+                    const gchar     *name)
+{
+  gint index;
+
+  index = subscribers_find (connection, name);
+
+  if (index >= 0)
+    g_ptr_array_remove_index_fast (subscribers, index);
+}
+
+gboolean
+subscribers_any (void)
+{
+  return subscribers && subscribers->len > 0;
+}
+
+/* Sends the signal to each subscriber and additionally to 'requester'
+ * on 'connection', if given, which is the client that caused the signal
+ * to be emitted.  On a peer-to-peer connection the requester is NULL
+ * and the signal goes to the peer.  Nothing at all is sent if there is
+ * nobody to receive it.
+ */
+void
+subscribers_emit_signal (GDBusConnection *connection,
+                         const gchar     *requester,
+                         const gchar     *object_path,
+                         const gchar     *interface_name,
+                         const gchar     *signal_name,
+                         GVariant        *parameters)
+{
+  gint64 start;
+  guint i;
+
+  start = g_get_monotonic_time ();
+
+  g_variant_ref_sink (parameters);
+
+  if (connection && (requester || g_dbus_connection_get_unique_name (connection) == NULL) &&
+      subscribers_find (connection, requester) < 0)
+    g_dbus_connection_emit_signal (connection, requester, object_path, interface_name,
+                                   signal_name, parameters, NULL);
+
+  for (i = 0; subscribers && i < subscribers->len; i++)
+    {
+      Subscriber *subscriber = g_ptr_array_index (subscribers, i);
+
+      g_dbus_connection_emit_signal (subscriber->connection, subscriber->name, object_path,
+                                     interface_name, signal_name, parameters, NULL);
+    }
+
+  g_variant_unref (parameters);
+
+  trace_add_time (TRACE_PHASE_SIGNAL, g_get_monotonic_time () - start);
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright © 2014 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#ifndef _subscribers_h_
+#define _subscribers_h_
+
+#include <gio/gio.h>
+
+void subscribers_add (GDBusConnection *connection,
+                      const gchar     *name);
+
+void subscribers_remove (GDBusConnection *connection,
+                         const gchar     *name);
+
+gboolean subscribers_any (void);
+
+void subscribers_emit_signal (GDBusConnection *connection,
+                              const gchar     *requester,
+                              const gchar     *object_path,
+                              const gchar     *interface_name,
+                              const gchar     *signal_name,
+                              GVariant        *parameters);
+
+#endif /* _subscribers_h_ */
@@ -10,6 +10,20 @@ static const gchar *systemd_iface =
      "<arg name='file' type='s' direction='in'/>"
      "<arg name='state' type='s' direction='out'/>"
     "</method>"
+    "<method name='GetUnit'>"
+     "<arg name='name' type='s' direction='in'/>"
+     "<arg name='unit' type='o' direction='out'/>"
+    "</method>"
+    "<method name='LoadUnit'>"
+     "<arg name='name' type='s' direction='in'/>"
+     "<arg name='unit' type='o' direction='out'/>"
+    "</method>"
+    "<method name='ListUnits'>"
+     "<arg name='units' type='a(ssssssouso)' direction='out'/>"
+    "</method>"
+    "<method name='ListUnitFiles'>"
+     "<arg name='files' type='a(ss)' direction='out'/>"
+    "</method>"
     "<method name='DisableUnitFiles'>"
      "<arg name='files' type='as' direction='in'/>"
      "<arg name='runtime' type='b' direction='in'/>"
@@ -47,11 +61,55 @@ static const gchar *systemd_iface =
     "<property name='Version' type='s' access='read'/>"
     "<property name='Virtualization' type='s' access='read'/>"
    "</interface>"
+   "<interface name='com.ubuntu.SystemdShim'>"
+    "<method name='StartTransientUnits'>"
+     "<arg name='units' type='a(sa(sv))' direction='in'/>"
+     "<arg name='results' type='a(ss)' direction='out'/>"
+    "</method>"
+    "<method name='StopUnits'>"
+     "<arg name='names' type='as' direction='in'/>"
+     "<arg name='results' type='a(ss)' direction='out'/>"
+    "</method>"
+    "<property name='Activations' type='t' access='read'/>"
+    "<property name='ColdStartUSec' type='t' access='read'/>"
+    "<property name='FirstReplyUSec' type='t' access='read'/>"
+    "<property name='UptimeUSec' type='t' access='read'/>"
+    "<property name='RequestRate' type='d' access='read'/>"
+    "<property name='IdleTimeoutUSec' type='t' access='read'/>"
+    "<property name='StayResident' type='b' access='read'/>"
+    "<property name='Container' type='s' access='read'/>"
+   "</interface>"
+   "<interface name='com.ubuntu.SystemdShim.Stats'>"
+    "<method name='GetStatistics'>"
+     "<arg name='statistics' type='a{sv}' direction='out'/>"
+    "</method>"
+    "<method name='ResetStatistics'/>"
+    "<method name='DumpTrace'>"
+     "<arg name='filename' type='s' direction='out'/>"
+    "</method>"
+    "<method name='GetPowerHistory'>"
+     "<arg name='history' type='a(sba{st})' direction='out'/>"
+    "</method>"
+   "</interface>"
+   "<interface name='com.ubuntu.SystemdShim.NTP'>"
+    "<property name='NTPSynchronized' type='b' access='read'/>"
+    "<property name='EstimatedErrorUSec' type='t' access='read'/>"
+    "<property name='MaxErrorUSec' type='t' access='read'/>"
+   "</interface>"
    "<interface name='org.freedesktop.systemd1.Scope'>"
     "<method name='Abandon'/>"
    "</interface>"
    "<interface name='org.freedesktop.systemd1.Unit'>"
+    "<property name='Id' type='s' access='read'/>"
+    "<property name='LoadState' type='s' access='read'/>"
     "<property name='ActiveState' type='s' access='read'/>"
+    "<property name='SubState' type='s' access='read'/>"
+    "<property name='ControlGroup' type='s' access='read'/>"
+    "<property name='StateChangeTimestamp' type='t' access='read'/>"
+    "<property name='ActiveEnterTimestamp' type='t' access='read'/>"
+    "<property name='ActiveExitTimestamp' type='t' access='read'/>"
+    "<property name='InactiveEnterTimestamp' type='t' access='read'/>"
+    "<property name='InactiveExitTimestamp' type='t' access='read'/>"
    "</interface>"
   "</node>";
 
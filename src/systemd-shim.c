@@ -18,46 +18,501 @@
  */
 
 #include <gio/gio.h>
+#include <glib-unix.h>
 
 #include "cgmanager.h"
+#include "kexec.h"
+#include "power-history.h"
+#include "private-server.h"
+#include "probes.h"
+#include "request-queue.h"
+#include "settings.h"
 #include "state.h"
+#include "stats.h"
+#include "subscribers.h"
+#include "trace.h"
 #include "unit.h"
-#include "virt.h"
+#include "unit-files.h"
+#include "virt-cache.h"
 
 #include "systemd-iface.h"
 
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <math.h>
+
+#define DAEMON_STATE_FILENAME "/run/systemd-shim-daemon"
+
+/* The request rate is an exponentially decaying count of activity,
+ * which works out to roughly the number of requests seen in the last
+ * RATE_DECAY_SECONDS.
+ */
+#define RATE_DECAY_SECONDS 60.0
+
+static gint64 start_time;
+static guint64 cold_start_usec;
+static guint64 first_reply_usec;
+static guint64 activation_count;
+
+static gdouble request_rate;
+static gint64 request_rate_time;
+
+static guint idle_timeout_min;
+static guint idle_timeout_max;
+static guint idle_busy_rate;
+static gboolean stay_resident;
+static gboolean private_socket;
+static guint idle_timeout;
+static guint inactivity_timeout;
+static guint pending_jobs;
+
+static void
+update_request_rate (gdouble increment)
+{
+  gint64 now = g_get_monotonic_time ();
+  gdouble elapsed;
+
+  elapsed = (gdouble) (now - request_rate_time) / G_TIME_SPAN_SECOND;
+  request_rate = request_rate * exp (-elapsed / RATE_DECAY_SECONDS) + increment;
+  request_rate_time = now;
+}
+
+static void
+daemon_state_load (void)
+{
+  GKeyFile *key_file;
+
+  key_file = g_key_file_new ();
+
+  if (g_key_file_load_from_file (key_file, DAEMON_STATE_FILENAME, G_KEY_FILE_NONE, NULL))
+    {
+      gint64 last_exit;
+
+      activation_count = g_key_file_get_uint64 (key_file, "Daemon", "Activations", NULL);
+      request_rate = g_key_file_get_double (key_file, "Daemon", "RequestRate", NULL);
+      last_exit = g_key_file_get_int64 (key_file, "Daemon", "LastExit", NULL);
+
+      /* Carry the rate over from the previous instance, decayed by the
+       * time that we were not running.  If we are being re-activated
+       * just after exiting, we will therefore stay around for longer.
+       */
+      request_rate_time = g_get_monotonic_time ();
+      if (last_exit && last_exit < g_get_real_time ())
+        request_rate_time -= g_get_real_time () - last_exit;
+      update_request_rate (0);
+    }
+
+  g_key_file_free (key_file);
+}
+
+static void
+daemon_state_save (gboolean exiting)
+{
+  GError *error = NULL;
+  GKeyFile *key_file;
+
+  key_file = g_key_file_new ();
+  g_key_file_set_uint64 (key_file, "Daemon", "Activations", activation_count);
+  g_key_file_set_double (key_file, "Daemon", "RequestRate", request_rate);
+  if (exiting)
+    g_key_file_set_int64 (key_file, "Daemon", "LastExit", g_get_real_time ());
+
+  if (!g_key_file_save_to_file (key_file, DAEMON_STATE_FILENAME, &error))
+    {
+      g_warning ("cannot save systemd-shim daemon state: %s", error->message);
+      g_error_free (error);
+    }
+
+  g_key_file_free (key_file);
+}
+
+static GMainLoop *main_loop;
 
 static gboolean
 exit_on_inactivity (gpointer user_data)
 {
   extern gboolean in_shutdown;
 
-  if (!in_shutdown)
-    {
-      GDBusConnection *system_bus;
+  /* A unit is still being stopped in the background: check again later */
+  if (unit_jobs_pending ())
+    return TRUE;
 
-      system_bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, NULL);
-      g_dbus_connection_flush_sync (system_bus, NULL, NULL);
-      g_object_unref (system_bus);
+  inactivity_timeout = 0;
 
-      exit (0);
+  /* Don't leave a job that is still running (a suspend, say) without
+   * anybody to report on it.  We get rescheduled when it finishes.
+   */
+  if (!in_shutdown && !pending_jobs)
+    {
+      SHIM_PROBE2 (inactivity_exit, idle_timeout, g_get_monotonic_time () - start_time);
+      g_main_loop_quit (main_loop);
     }
 
   return FALSE;
 }
 
+static gboolean
+exit_on_signal (gpointer user_data)
+{
+  g_debug ("Exiting on signal %d", GPOINTER_TO_INT (user_data));
+  g_main_loop_quit (main_loop);
+
+  return TRUE;
+}
+
+static gboolean
+dump_trace_on_signal (gpointer user_data)
+{
+  GError *error = NULL;
+
+  if (!trace_dump (TRACE_FILENAME, &error))
+    {
+      g_warning ("Unable to dump request trace: %s", error->message);
+      g_error_free (error);
+    }
+
+  return TRUE;
+}
+
 static void
-had_activity (void)
+schedule_exit_on_inactivity (void)
 {
-  static gint inactivity_timeout;
+  gdouble busyness;
 
   if (inactivity_timeout)
     g_source_remove (inactivity_timeout);
+  inactivity_timeout = 0;
+
+  if (stay_resident)
+    return;
+
+  /* Scale linearly from the minimum timeout when idle to the maximum
+   * timeout when we are seeing at least idle_busy_rate requests per
+   * decay period.  Being re-activated is much more expensive than
+   * hanging around for a bit longer.
+   */
+  busyness = MIN (request_rate / idle_busy_rate, 1.0);
+  idle_timeout = idle_timeout_min + (guint) ((idle_timeout_max - idle_timeout_min) * busyness);
+
+  inactivity_timeout = g_timeout_add_seconds (idle_timeout, exit_on_inactivity, NULL);
+}
+
+static void
+had_activity (void)
+{
+  if (!first_reply_usec)
+    {
+      first_reply_usec = g_get_monotonic_time () - start_time;
+      g_debug ("First request handled %" G_GUINT64_FORMAT "us after startup", first_reply_usec);
+    }
+
+  update_request_rate (1);
+  schedule_exit_on_inactivity ();
+}
+
+static gchar *
+unescape_object_path (const gchar *path)
+{
+  gchar *result;
+  gint i, j;
+
+  result = g_malloc (strlen (path) + 1);
+  for (i = 0, j = 0; path[i]; i++)
+    {
+      if (path[i] == '_')
+        {
+          if (g_ascii_isxdigit (path[i + 1]) && g_ascii_isxdigit (path[i + 2]))
+            {
+              gint val = g_ascii_xdigit_value(path[i + 1]) * 16 + g_ascii_xdigit_value (path[i + 2]);
+
+              if (g_ascii_isgraph (val))
+                result[j++] = val;
+
+              i += 2;
+            }
+        }
+
+      else
+        result[j++] = path[i];
+    }
+
+  result[j] = '\0';
+
+  return result;
+}
+
+static gchar *
+escape_object_path (const gchar *path)
+{
+  gchar *result;
+  gint i, j;
+
+  result = g_malloc (3 * strlen (path) + 1);
+  for (i = 0, j = 0; path[i]; i++)
+    {
+      if (g_ascii_isalnum (path[i]))
+        result[j++] = path[i];
+      else
+        {
+          snprintf (&result[j], 4, "_%02x", (guint) path[i]);
+          j += 3;
+        }
+    }
+
+  result[j] = '\0';
+
+  return result;
+}
+
+/* The Stats methods that change anything are for root only */
+static void
+shim_stats_privileged_call (GDBusMethodInvocation *invocation)
+{
+  const gchar *method_name = g_dbus_method_invocation_get_method_name (invocation);
+
+  if (g_str_equal (method_name, "ResetStatistics"))
+    {
+      stats_reset ();
+      g_dbus_method_invocation_return_value (invocation, NULL);
+    }
+
+  /* This writes to a fixed file in /run, as root */
+  else if (g_str_equal (method_name, "DumpTrace"))
+    {
+      GError *error = NULL;
+
+      if (trace_dump (TRACE_FILENAME, &error))
+        g_dbus_method_invocation_return_value (invocation, g_variant_new ("(s)", TRACE_FILENAME));
+      else
+        {
+          g_dbus_method_invocation_return_gerror (invocation, error);
+          g_error_free (error);
+        }
+    }
+
+  else
+    g_assert_not_reached ();
+}
+
+static void
+shim_stats_got_unix_user (GObject      *source_object,
+                          GAsyncResult *result,
+                          gpointer      user_data)
+{
+  GDBusMethodInvocation *invocation = user_data;
+  GVariant *reply;
+  guint32 uid;
+
+  reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object), result, NULL);
+
+  if (!reply)
+    {
+      g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_ACCESS_DENIED,
+                                             "Could not determine the caller's uid");
+      return;
+    }
+
+  g_variant_get (reply, "(u)", &uid);
+  g_variant_unref (reply);
+
+  if (uid != 0)
+    {
+      g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_ACCESS_DENIED,
+                                             "%s is only allowed for root",
+                                             g_dbus_method_invocation_get_method_name (invocation));
+      return;
+    }
+
+  shim_stats_privileged_call (invocation);
+}
+
+/* Like the rate limit exemption in the request queue, ask dbus-daemon
+ * who the caller is without waiting for the answer.
+ */
+static void
+shim_stats_check_root (GDBusMethodInvocation *invocation)
+{
+  const gchar *sender = g_dbus_method_invocation_get_sender (invocation);
+
+  /* Only root can connect to the private socket */
+  if (sender == NULL)
+    {
+      shim_stats_privileged_call (invocation);
+      return;
+    }
+
+  g_dbus_connection_call (g_dbus_method_invocation_get_connection (invocation),
+                          "org.freedesktop.DBus", "/org/freedesktop/DBus",
+                          "org.freedesktop.DBus", "GetConnectionUnixUser",
+                          g_variant_new ("(s)", sender), G_VARIANT_TYPE ("(u)"),
+                          G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+                          shim_stats_got_unix_user, invocation);
+}
+
+static void
+shim_stats_method_call (GDBusConnection       *connection,
+                        const gchar           *sender,
+                        const gchar           *object_path,
+                        const gchar           *interface_name,
+                        const gchar           *method_name,
+                        GVariant              *parameters,
+                        GDBusMethodInvocation *invocation,
+                        gpointer               user_data)
+{
+  had_activity ();
+
+  if (g_str_equal (method_name, "GetStatistics"))
+    g_dbus_method_invocation_return_value (invocation, g_variant_new ("(@a{sv})", stats_get_variant ()));
+
+  else if (g_str_equal (method_name, "ResetStatistics"))
+    shim_stats_check_root (invocation);
+
+  else if (g_str_equal (method_name, "DumpTrace"))
+    shim_stats_check_root (invocation);
+
+  else if (g_str_equal (method_name, "GetPowerHistory"))
+    g_dbus_method_invocation_return_value (invocation,
+                                           g_variant_new ("(@a(sba{st}))", power_history_get_variant ()));
+
+  else
+    g_assert_not_reached ();
+}
+
+static gchar *
+unit_object_path (const gchar *unit_name)
+{
+  gchar *escaped;
+  gchar *path;
+
+  escaped = escape_object_path (unit_name);
+  path = g_strconcat ("/org/freedesktop/systemd1/unit/", escaped, NULL);
+  g_free (escaped);
+
+  return path;
+}
+
+static gboolean
+shim_list_units_add (const gchar *name,
+                     Unit        *unit,
+                     gpointer     user_data)
+{
+  GVariantBuilder *builder = user_data;
+  gchar *object_path;
+
+  object_path = unit_object_path (name);
+  g_variant_builder_add (builder, "(ssssssouso)", name, "", "loaded",
+                         unit_get_active_state (unit), unit_get_sub_state (unit),
+                         "", object_path, 0, "", "/");
+  g_free (object_path);
+
+  return FALSE;
+}
+
+/* We have no unit files: the name stands in for the path, which is
+ * what systemctl shows the basename of anyway.
+ */
+static gboolean
+shim_list_unit_files_add (const gchar *name,
+                          const gchar *state,
+                          gpointer     user_data)
+{
+  g_variant_builder_add (user_data, "(ss)", name, state);
+
+  return FALSE;
+}
+
+static gboolean
+shim_list_own_unit_files_add (const gchar *name,
+                              Unit        *unit,
+                              gpointer     user_data)
+{
+  if (!unit_is_transient (unit) && !unit_files_get_state (name))
+    g_variant_builder_add (user_data, "(ss)", name, unit_get_state (unit));
+
+  return FALSE;
+}
+
+static void
+shim_set_enabled_done (GObject      *source_object,
+                       GAsyncResult *result,
+                       gpointer      user_data)
+{
+  GDBusMethodInvocation *invocation = user_data;
+  GError *error = NULL;
+  GVariant *changes;
+
+  changes = unit_files_set_enabled_finish (result, &error);
+
+  if (changes == NULL)
+    {
+      g_dbus_method_invocation_return_gerror (invocation, error);
+      g_error_free (error);
+    }
+  else if (g_str_equal (g_dbus_method_invocation_get_method_name (invocation), "EnableUnitFiles"))
+    g_dbus_method_invocation_return_value (invocation, g_variant_new ("(b@a(sss))", TRUE, changes));
+  else
+    g_dbus_method_invocation_return_value (invocation, g_variant_new ("(@a(sss))", changes));
+
+  if (changes)
+    g_variant_unref (changes);
+
+  pending_jobs--;
+  had_activity ();
+}
+
+typedef struct
+{
+  GDBusConnection *connection;
+  gchar *sender;
+} ShimJob;
 
-  inactivity_timeout = g_timeout_add (10000, exit_on_inactivity, NULL);
+static void
+shim_start_unit_done (GObject      *source_object,
+                      GAsyncResult *result,
+                      gpointer      user_data)
+{
+  Unit *unit = (Unit *) source_object;
+  ShimJob *job = user_data;
+
+  unit_start_finish (unit, result, NULL);
+
+  subscribers_emit_signal (job->connection, job->sender, "/org/freedesktop/systemd1",
+                           "org.freedesktop.systemd1.Manager", "JobRemoved",
+                           g_variant_new ("(uoss)", 0, "/", unit_get_name (unit), unit_get_job_result (unit)));
+
+  g_object_unref (job->connection);
+  g_free (job->sender);
+  g_slice_free (ShimJob, job);
+
+  pending_jobs--;
+  had_activity ();
+}
+
+static void
+shim_stop_unit_done (GObject      *source_object,
+                     GAsyncResult *result,
+                     gpointer      user_data)
+{
+  Unit *unit = (Unit *) source_object;
+  ShimJob *job = user_data;
+
+  unit_stop_finish (unit, result, NULL);
+
+  subscribers_emit_signal (job->connection, job->sender, "/org/freedesktop/systemd1",
+                           "org.freedesktop.systemd1.Manager", "JobRemoved",
+                           g_variant_new ("(uoss)", 0, "/", unit_get_name (unit), unit_get_job_result (unit)));
+  if (subscribers_any ())
+    subscribers_emit_signal (NULL, NULL, "/org/freedesktop/systemd1",
+                             "org.freedesktop.systemd1.Manager", "UnitRemoved",
+                             g_variant_new ("(so)", unit_get_name (unit), "/"));
+
+  g_object_unref (job->connection);
+  g_free (job->sender);
+  g_slice_free (ShimJob, job);
+
+  pending_jobs--;
+  had_activity ();
 }
 
 static void
@@ -70,14 +525,33 @@ shim_method_call (GDBusConnection       *connection,
                   GDBusMethodInvocation *invocation,
                   gpointer               user_data)
 {
+  const gchar *unit_name = NULL;
+  gboolean failed = FALSE;
   GError *error = NULL;
+  gint64 start;
+
+  start = g_get_monotonic_time ();
+
+  /* All of our methods that take a unit name take it first */
+  if (g_str_has_prefix (g_variant_get_type_string (parameters), "(s"))
+    g_variant_get_child (parameters, 0, "&s", &unit_name);
+
+  trace_begin (method_name, unit_name, sender);
 
   if (g_str_equal (method_name, "GetUnitFileState"))
     {
-      const gchar *unit_name;
+      const gchar *state;
       Unit *unit;
 
-      g_variant_get_child (parameters, 0, "&s", &unit_name);
+      /* Init scripts and upstart jobs come from the index, without
+       * having to load the unit.
+       */
+      if ((state = unit_files_get_state (unit_name)))
+        {
+          g_dbus_method_invocation_return_value (invocation, g_variant_new ("(s)", state));
+          goto success;
+        }
+
       unit = lookup_unit (unit_name, &error);
 
       if (unit)
@@ -89,52 +563,130 @@ shim_method_call (GDBusConnection       *connection,
         }
     }
 
-  else if (g_str_equal (method_name, "DisableUnitFiles"))
+  else if (g_str_equal (method_name, "GetUnit"))
+    {
+      gchar *object_path;
+      Unit *unit;
+
+      unit = unit_get_loaded (unit_name);
+
+      if (!unit)
+        {
+          g_dbus_method_invocation_return_dbus_error (invocation, "org.freedesktop.systemd1.NoSuchUnit",
+                                                      "Unit not loaded.");
+          failed = TRUE;
+          goto success;
+        }
+
+      object_path = unit_object_path (unit_name);
+      g_dbus_method_invocation_return_value (invocation, g_variant_new ("(o)", object_path));
+      g_free (object_path);
+      g_object_unref (unit);
+      goto success;
+    }
+
+  else if (g_str_equal (method_name, "LoadUnit"))
+    {
+      Unit *unit;
+
+      unit = lookup_unit (unit_name, &error);
+
+      if (unit)
+        {
+          gchar *object_path;
+
+          object_path = unit_object_path (unit_name);
+          g_dbus_method_invocation_return_value (invocation, g_variant_new ("(o)", object_path));
+          g_free (object_path);
+          g_object_unref (unit);
+          goto success;
+        }
+    }
+
+  else if (g_str_equal (method_name, "ListUnits"))
     {
-      g_dbus_method_invocation_return_value (invocation, g_variant_new ("(a(sss))", NULL));
+      GVariantBuilder builder;
+
+      g_variant_builder_init (&builder, G_VARIANT_TYPE ("(a(ssssssouso))"));
+      g_variant_builder_open (&builder, G_VARIANT_TYPE ("a(ssssssouso)"));
+      unit_foreach (shim_list_units_add, &builder);
+      g_variant_builder_close (&builder);
+      g_dbus_method_invocation_return_value (invocation, g_variant_builder_end (&builder));
+      goto success;
+    }
+
+  else if (g_str_equal (method_name, "ListUnitFiles"))
+    {
+      GVariantBuilder builder;
+
+      g_variant_builder_init (&builder, G_VARIANT_TYPE ("(a(ss))"));
+      g_variant_builder_open (&builder, G_VARIANT_TYPE ("a(ss)"));
+      unit_files_foreach (shim_list_unit_files_add, &builder);
+      unit_foreach (shim_list_own_unit_files_add, &builder);
+      g_variant_builder_close (&builder);
+      g_dbus_method_invocation_return_value (invocation, g_variant_builder_end (&builder));
       goto success;
     }
 
-  else if (g_str_equal (method_name, "EnableUnitFiles"))
+  else if (g_str_equal (method_name, "DisableUnitFiles") || g_str_equal (method_name, "EnableUnitFiles"))
     {
-      g_dbus_method_invocation_return_value (invocation, g_variant_new ("(ba(sss))", TRUE, NULL));
+      const gchar **names;
+
+      /* The whole batch goes to update-rc.d at once; we reply when it
+       * is done.
+       */
+      g_variant_get_child (parameters, 0, "^a&s", &names);
+      pending_jobs++;
+      unit_files_set_enabled_async (names, g_str_equal (method_name, "EnableUnitFiles"),
+                                    shim_set_enabled_done, g_object_ref (invocation));
+      g_free (names);
       goto success;
     }
 
   else if (g_str_equal (method_name, "Reload"))
     {
+      unit_files_reload ();
       g_dbus_method_invocation_return_value (invocation, NULL);
       goto success;
     }
 
   else if (g_str_equal (method_name, "Subscribe"))
     {
+      subscribers_add (connection, sender);
       g_dbus_method_invocation_return_value (invocation, NULL);
       goto success;
     }
 
   else if (g_str_equal (method_name, "Unsubscribe"))
     {
+      subscribers_remove (connection, sender);
       g_dbus_method_invocation_return_value (invocation, NULL);
       goto success;
     }
 
   else if (g_str_equal (method_name, "StopUnit"))
     {
-      const gchar *unit_name;
       Unit *unit;
 
-      g_variant_get_child (parameters, 0, "&s", &unit_name);
       g_debug ("StopUnit(%s)", unit_name);
       unit = lookup_unit (unit_name, &error);
 
       if (unit)
         {
-          unit_stop (unit);
+          ShimJob *job;
+
+          /* As with StartUnit, JobRemoved tells the caller when the
+           * stop is actually done: a service's stop script can take a
+           * while.
+           */
           g_dbus_method_invocation_return_value (invocation, g_variant_new ("(o)", "/"));
-          g_dbus_connection_emit_signal (connection, NULL, "/org/freedesktop/systemd1",
-                                         "org.freedesktop.systemd1.Manager", "UnitRemoved",
-                                         g_variant_new ("(so)", unit_name, "/"), NULL);
+
+          job = g_slice_new (ShimJob);
+          job->connection = g_object_ref (connection);
+          job->sender = g_strdup (sender);
+          pending_jobs++;
+
+          unit_stop_async (unit, shim_stop_unit_done, job);
           g_object_unref (unit);
           goto success;
         }
@@ -142,59 +694,233 @@ shim_method_call (GDBusConnection       *connection,
 
   else if (g_str_equal (method_name, "StartUnit"))
     {
-      const gchar *unit_name;
       Unit *unit;
 
-      g_variant_get_child (parameters, 0, "&s", &unit_name);
       g_debug ("StartUnit(%s)", unit_name);
       unit = lookup_unit (unit_name, &error);
 
       if (unit)
         {
-          unit_start (unit);
+          ShimJob *job;
+
+          /* Reply straight away: JobRemoved tells the caller when the
+           * job is actually done, which can be much later (after
+           * resume, say).
+           */
           g_dbus_method_invocation_return_value (invocation, g_variant_new ("(o)", "/"));
-          g_dbus_connection_emit_signal (connection, sender, "/org/freedesktop/systemd1",
-                                         "org.freedesktop.systemd1.Manager", "JobRemoved",
-                                         g_variant_new ("(uoss)", 0, "/", "", ""), NULL);
+
+          if (unit_is_disruptive (unit))
+            g_dbus_connection_flush_sync (connection, NULL, NULL);
+
+          job = g_slice_new (ShimJob);
+          job->connection = g_object_ref (connection);
+          job->sender = g_strdup (sender);
+          pending_jobs++;
+
+          unit_start_async (unit, shim_start_unit_done, job);
           g_object_unref (unit);
           goto success;
         }
     }
   else if (g_str_equal (method_name, "StartTransientUnit"))
     {
-      const gchar *unit_name;
       Unit *unit;
 
-      g_variant_get_child (parameters, 0, "&s", &unit_name);
       g_debug ("StartTransientUnit(%s)", unit_name);
       unit = lookup_unit (unit_name, &error);
 
       if (unit)
         {
           GVariant *properties;
+          const gchar *result;
 
           properties = g_variant_get_child_value (parameters, 2);
-          unit_start_transient (unit, properties);
+          result = unit_start_transient (unit, properties) ? unit_get_job_result (unit) : "invalid";
           g_dbus_method_invocation_return_value (invocation, g_variant_new ("(o)", "/"));
-          g_dbus_connection_emit_signal (connection, sender, "/org/freedesktop/systemd1",
-                                         "org.freedesktop.systemd1.Manager", "JobRemoved",
-                                         g_variant_new ("(uoss)", 0, "/", unit_get_state(unit), "done"), NULL);
+          subscribers_emit_signal (connection, sender, "/org/freedesktop/systemd1",
+                                   "org.freedesktop.systemd1.Manager", "JobRemoved",
+                                   g_variant_new ("(uoss)", 0, "/", unit_name, result));
           g_variant_unref (properties);
           g_object_unref (unit);
           goto success;
       }
   }
 
+  else if (g_str_equal (method_name, "StartTransientUnits"))
+    {
+      GVariantBuilder builder;
+      GVariant *properties;
+      GVariantIter *iter;
+      const gchar *name;
+      GPtrArray *units;
+      guint i;
+
+      g_variant_get (parameters, "(a(sa(sv)))", &iter);
+      g_debug ("StartTransientUnits(%" G_GSIZE_FORMAT " units)", g_variant_iter_n_children (iter));
+
+      g_variant_builder_init (&builder, G_VARIANT_TYPE ("(a(ss))"));
+      g_variant_builder_open (&builder, G_VARIANT_TYPE ("a(ss)"));
+      units = g_ptr_array_new_with_free_func (g_object_unref);
+
+      state_freeze ();
+
+      while (g_variant_iter_loop (iter, "(&s@a(sv))", &name, &properties))
+        {
+          Unit *unit;
+
+          unit = lookup_unit (name, NULL);
+
+          /* Only units that we actually tried to start get a job */
+          if (unit && unit_start_transient (unit, properties))
+            {
+              g_variant_builder_add (&builder, "(ss)", name, unit_get_job_result (unit));
+              g_ptr_array_add (units, unit);
+            }
+          else
+            {
+              g_variant_builder_add (&builder, "(ss)", name, "invalid");
+              if (unit)
+                g_object_unref (unit);
+            }
+        }
+
+      state_thaw ();
+
+      g_variant_builder_close (&builder);
+      g_dbus_method_invocation_return_value (invocation, g_variant_builder_end (&builder));
+
+      for (i = 0; i < units->len; i++)
+        {
+          Unit *unit = g_ptr_array_index (units, i);
+
+          subscribers_emit_signal (connection, sender, "/org/freedesktop/systemd1",
+                                   "org.freedesktop.systemd1.Manager", "JobRemoved",
+                                   g_variant_new ("(uoss)", 0, "/", unit_get_name (unit), unit_get_job_result (unit)));
+        }
+
+      g_ptr_array_unref (units);
+      g_variant_iter_free (iter);
+      goto success;
+    }
+
+  else if (g_str_equal (method_name, "StopUnits"))
+    {
+      GVariantBuilder builder;
+      const gchar **names;
+      GPtrArray *units;
+      Unit **found;
+      guint n_names;
+      guint i, j;
+
+      g_variant_get (parameters, "(^a&s)", &names);
+      n_names = g_strv_length ((gchar **) names);
+      g_debug ("StopUnits(%u units)", n_names);
+
+      /* 'found' has an entry for each name, in order, for the reply;
+       * 'units' has each unit once, for stopping.
+       */
+      found = g_new0 (Unit *, n_names);
+      units = g_ptr_array_new_with_free_func (g_object_unref);
+
+      for (i = 0; i < n_names; i++)
+        {
+          found[i] = lookup_unit (names[i], NULL);
+
+          if (!found[i])
+            continue;
+
+          for (j = 0; j < units->len; j++)
+            if (g_ptr_array_index (units, j) == found[i])
+              break;
+
+          if (j == units->len)
+            g_ptr_array_add (units, g_object_ref (found[i]));
+        }
+
+      unit_stop_many ((Unit **) units->pdata, units->len);
+
+      g_variant_builder_init (&builder, G_VARIANT_TYPE ("(a(ss))"));
+      g_variant_builder_open (&builder, G_VARIANT_TYPE ("a(ss)"));
+
+      for (i = 0; i < n_names; i++)
+        {
+          if (found[i])
+            {
+              g_variant_builder_add (&builder, "(ss)", names[i], unit_get_job_result (found[i]));
+              g_object_unref (found[i]);
+            }
+          else
+            g_variant_builder_add (&builder, "(ss)", names[i], "invalid");
+        }
+
+      g_free (found);
+      g_variant_builder_close (&builder);
+      g_dbus_method_invocation_return_value (invocation, g_variant_builder_end (&builder));
+
+      for (i = 0; subscribers_any () && i < units->len; i++)
+        subscribers_emit_signal (NULL, NULL, "/org/freedesktop/systemd1",
+                                 "org.freedesktop.systemd1.Manager", "UnitRemoved",
+                                 g_variant_new ("(so)", unit_get_name (g_ptr_array_index (units, i)), "/"));
+
+      g_ptr_array_unref (units);
+      g_free (names);
+      goto success;
+    }
+
   else
     g_assert_not_reached ();
 
   g_dbus_method_invocation_return_gerror (invocation, error);
   g_error_free (error);
+  failed = TRUE;
 
 success:
+  stats_record_request (method_name, unit_name, failed, g_get_monotonic_time () - start);
+  trace_end (failed);
   had_activity ();
 }
 
+static RequestClass
+shim_classify_request (const gchar *method_name,
+                       GVariant    *parameters)
+{
+  const gchar *unit_name;
+
+  if (g_str_equal (method_name, "StartTransientUnit") || g_str_equal (method_name, "StartTransientUnits"))
+    return REQUEST_CLASS_SESSION;
+
+  if (g_str_equal (method_name, "StopUnit") || g_str_equal (method_name, "StopUnits") ||
+      g_str_equal (method_name, "Abandon"))
+    return REQUEST_CLASS_TEARDOWN;
+
+  if (g_str_equal (method_name, "StartUnit"))
+    {
+      g_variant_get_child (parameters, 0, "&s", &unit_name);
+
+      if (g_str_has_suffix (unit_name, ".target"))
+        return REQUEST_CLASS_POWER;
+
+      if (g_str_has_suffix (unit_name, ".slice"))
+        return REQUEST_CLASS_SESSION;
+    }
+
+  return REQUEST_CLASS_DEFAULT;
+}
+
+static void
+shim_method_call_queued (GDBusConnection       *connection,
+                         const gchar           *sender,
+                         const gchar           *object_path,
+                         const gchar           *interface_name,
+                         const gchar           *method_name,
+                         GVariant              *parameters,
+                         GDBusMethodInvocation *invocation,
+                         gpointer               user_data)
+{
+  request_queue_push (invocation, shim_classify_request (method_name, parameters),
+                      shim_method_call, NULL, NULL);
+}
+
 static GVariant *
 shim_get_property (GDBusConnection  *connection,
                    const gchar      *sender,
@@ -204,13 +930,10 @@ shim_get_property (GDBusConnection  *connection,
                    GError          **error,
                    gpointer          user_data)
 {
-  const gchar *id = "";
-
   had_activity ();
 
   if (g_strcmp0(property_name, "Virtualization") == 0) {
-      detect_virtualization (&id);
-      return g_variant_new ("s", id);
+      return g_variant_new ("s", virt_cache_get_virtualization ());
   }
 
   if (g_strcmp0(property_name, "Version") == 0) {
@@ -220,58 +943,43 @@ shim_get_property (GDBusConnection  *connection,
   return NULL;
 }
 
-static gchar *
-unescape_object_path (const gchar *path)
+static GVariant *
+shim_daemon_get_property (GDBusConnection  *connection,
+                          const gchar      *sender,
+                          const gchar      *object_path,
+                          const gchar      *interface_name,
+                          const gchar      *property_name,
+                          GError          **error,
+                          gpointer          user_data)
 {
-  gchar *result;
-  gint i, j;
+  if (g_str_equal (property_name, "Activations"))
+    return g_variant_new_uint64 (activation_count);
 
-  result = g_malloc (strlen (path) + 1);
-  for (i = 0, j = 0; path[i]; i++)
-    {
-      if (path[i] == '_')
-        {
-          if (g_ascii_isxdigit (path[i + 1]) && g_ascii_isxdigit (path[i + 2]))
-            {
-              gint val = g_ascii_xdigit_value(path[i + 1]) * 16 + g_ascii_xdigit_value (path[i + 2]);
+  if (g_str_equal (property_name, "ColdStartUSec"))
+    return g_variant_new_uint64 (cold_start_usec);
 
-              if (g_ascii_isgraph (val))
-                result[j++] = val;
+  if (g_str_equal (property_name, "FirstReplyUSec"))
+    return g_variant_new_uint64 (first_reply_usec);
 
-              i += 2;
-            }
-        }
+  if (g_str_equal (property_name, "UptimeUSec"))
+    return g_variant_new_uint64 (g_get_monotonic_time () - start_time);
 
-      else
-        result[j++] = path[i];
+  if (g_str_equal (property_name, "RequestRate"))
+    {
+      update_request_rate (0);
+      return g_variant_new_double (request_rate);
     }
 
-  result[j] = '\0';
-
-  return result;
-}
-
-static gchar *
-escape_object_path (const gchar *path)
-{
-  gchar *result;
-  gint i, j;
+  if (g_str_equal (property_name, "IdleTimeoutUSec"))
+    return g_variant_new_uint64 (stay_resident ? 0 : (guint64) idle_timeout * G_TIME_SPAN_SECOND);
 
-  result = g_malloc (3 * strlen (path) + 1);
-  for (i = 0, j = 0; path[i]; i++)
-    {
-      if (g_ascii_isalnum (path[i]))
-        result[j++] = path[i];
-      else
-        {
-          snprintf (&result[j], 4, "_%02x", (guint) path[i]);
-          j += 3;
-        }
-    }
+  if (g_str_equal (property_name, "StayResident"))
+    return g_variant_new_boolean (stay_resident);
 
-  result[j] = '\0';
+  if (g_str_equal (property_name, "Container"))
+    return g_variant_new_string (virt_cache_get_container ());
 
-  return result;
+  return NULL;
 }
 
 static void
@@ -285,6 +993,9 @@ shim_unit_method_call (GDBusConnection       *connection,
                        gpointer               user_data)
 {
   const gchar *node = user_data;
+  gint64 start;
+
+  start = g_get_monotonic_time ();
 
   had_activity ();
 
@@ -295,6 +1006,7 @@ shim_unit_method_call (GDBusConnection       *connection,
       Unit *unit;
 
       unit_name = unescape_object_path (node);
+      trace_begin (method_name, unit_name, sender);
       unit = lookup_unit (unit_name, &error);
 
       if (unit)
@@ -310,6 +1022,8 @@ shim_unit_method_call (GDBusConnection       *connection,
           g_error_free (error);
         }
 
+      stats_record_request (method_name, unit_name, unit == NULL, g_get_monotonic_time () - start);
+      trace_end (unit == NULL);
       g_free (unit_name);
     }
 
@@ -317,6 +1031,21 @@ shim_unit_method_call (GDBusConnection       *connection,
     g_assert_not_reached ();
 }
 
+static void
+shim_unit_method_call_queued (GDBusConnection       *connection,
+                              const gchar           *sender,
+                              const gchar           *object_path,
+                              const gchar           *interface_name,
+                              const gchar           *method_name,
+                              GVariant              *parameters,
+                              GDBusMethodInvocation *invocation,
+                              gpointer               user_data)
+{
+  /* 'user_data' is the node, which is only valid for this call */
+  request_queue_push (invocation, shim_classify_request (method_name, parameters),
+                      shim_unit_method_call, g_strdup (user_data), g_free);
+}
+
 static GVariant *
 shim_unit_get_property (GDBusConnection  *connection,
                         const gchar      *sender,
@@ -326,15 +1055,165 @@ shim_unit_get_property (GDBusConnection  *connection,
                         GError          **error,
                         gpointer          user_data)
 {
+  const gchar *node = user_data;
+  GVariant *result = NULL;
+  gchar *unit_name;
+  Unit *unit;
+
   had_activity ();
 
-  /* FIXME: This is probably wrong for many cases, but the right value for
-   * logind cleaning up sessions */
-  if (g_strcmp0(property_name, "ActiveState") == 0) {
-      return g_variant_new_string ("inactive");
-  }
+  unit_name = unescape_object_path (node);
+  unit = lookup_unit (unit_name, NULL);
 
-  return NULL;
+  /* logind polls ActiveState until the unit is gone, and takes any error
+   * other than NoSuchUnit to mean that it is still there.  So a unit we
+   * don't know about is simply inactive, as systemd reports it.
+   */
+  if (!unit)
+    {
+      if (g_str_equal (property_name, "Id"))
+        result = g_variant_new_string (unit_name);
+      else if (g_str_equal (property_name, "LoadState"))
+        result = g_variant_new_string ("not-found");
+      else if (g_str_equal (property_name, "ActiveState"))
+        result = g_variant_new_string ("inactive");
+      else if (g_str_equal (property_name, "SubState"))
+        result = g_variant_new_string ("dead");
+      else if (g_str_equal (property_name, "ControlGroup"))
+        result = g_variant_new_string ("");
+      else
+        result = g_variant_new_uint64 (0);
+
+      g_free (unit_name);
+
+      return result;
+    }
+
+  g_free (unit_name);
+
+  if (g_str_equal (property_name, "Id"))
+    result = g_variant_new_string (unit_get_name (unit));
+
+  else if (g_str_equal (property_name, "LoadState"))
+    result = g_variant_new_string ("loaded");
+
+  else if (g_str_equal (property_name, "ActiveState"))
+    result = g_variant_new_string (unit_get_active_state (unit));
+
+  else if (g_str_equal (property_name, "SubState"))
+    result = g_variant_new_string (unit_get_sub_state (unit));
+
+  else if (g_str_equal (property_name, "ControlGroup"))
+    {
+      gchar *cgroup;
+
+      cgroup = unit_get_control_group (unit);
+      result = g_variant_new_string (cgroup ? cgroup : "");
+      g_free (cgroup);
+    }
+
+  else if (g_str_equal (property_name, "StateChangeTimestamp"))
+    result = g_variant_new_uint64 (unit->state_change_timestamp);
+
+  else if (g_str_equal (property_name, "ActiveEnterTimestamp"))
+    result = g_variant_new_uint64 (unit->active_enter_timestamp);
+
+  else if (g_str_equal (property_name, "ActiveExitTimestamp"))
+    result = g_variant_new_uint64 (unit->active_exit_timestamp);
+
+  else if (g_str_equal (property_name, "InactiveEnterTimestamp"))
+    result = g_variant_new_uint64 (unit->inactive_enter_timestamp);
+
+  else if (g_str_equal (property_name, "InactiveExitTimestamp"))
+    result = g_variant_new_uint64 (unit->inactive_exit_timestamp);
+
+  g_object_unref (unit);
+
+  return result;
+}
+
+static GVariant *
+shim_ntp_get_property (GDBusConnection  *connection,
+                       const gchar      *sender,
+                       const gchar      *object_path,
+                       const gchar      *interface_name,
+                       const gchar      *property_name,
+                       GError          **error,
+                       gpointer          user_data)
+{
+  const gchar *node = user_data;
+  guint64 estimated_error;
+  GVariant *result = NULL;
+  gboolean synchronized;
+  guint64 max_error;
+  gchar *unit_name;
+  Unit *unit;
+
+  had_activity ();
+
+  unit_name = unescape_object_path (node);
+  unit = lookup_unit (unit_name, error);
+  g_free (unit_name);
+
+  if (!unit)
+    return NULL;
+
+  if (!ntp_unit_get_sync_status (unit, &synchronized, &estimated_error, &max_error))
+    {
+      g_set_error (error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+                   "%s is not an NTP unit", unit_get_name (unit));
+      g_object_unref (unit);
+      return NULL;
+    }
+
+  if (g_str_equal (property_name, "NTPSynchronized"))
+    result = g_variant_new_boolean (synchronized);
+
+  else if (g_str_equal (property_name, "EstimatedErrorUSec"))
+    result = g_variant_new_uint64 (estimated_error);
+
+  else if (g_str_equal (property_name, "MaxErrorUSec"))
+    result = g_variant_new_uint64 (max_error);
+
+  g_object_unref (unit);
+
+  return result;
+}
+
+static void
+shim_unit_state_changed (Unit *unit)
+{
+  GVariantBuilder builder;
+  gchar *object_path;
+
+  if (!subscribers_any ())
+    return;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+  g_variant_builder_add (&builder, "{sv}", "ActiveState", g_variant_new_string (unit_get_active_state (unit)));
+  g_variant_builder_add (&builder, "{sv}", "SubState", g_variant_new_string (unit_get_sub_state (unit)));
+  g_variant_builder_add (&builder, "{sv}", "StateChangeTimestamp", g_variant_new_uint64 (unit->state_change_timestamp));
+  g_variant_builder_add (&builder, "{sv}", "ActiveEnterTimestamp", g_variant_new_uint64 (unit->active_enter_timestamp));
+  g_variant_builder_add (&builder, "{sv}", "ActiveExitTimestamp", g_variant_new_uint64 (unit->active_exit_timestamp));
+  g_variant_builder_add (&builder, "{sv}", "InactiveEnterTimestamp", g_variant_new_uint64 (unit->inactive_enter_timestamp));
+  g_variant_builder_add (&builder, "{sv}", "InactiveExitTimestamp", g_variant_new_uint64 (unit->inactive_exit_timestamp));
+
+  object_path = unit_object_path (unit_get_name (unit));
+
+  subscribers_emit_signal (NULL, NULL, object_path, "org.freedesktop.DBus.Properties", "PropertiesChanged",
+                           g_variant_new ("(sa{sv}as)", "org.freedesktop.systemd1.Unit", &builder, NULL));
+
+  g_free (object_path);
+}
+
+static gboolean
+shim_units_enumerate_add (const gchar *name,
+                          Unit        *unit,
+                          gpointer     user_data)
+{
+  g_ptr_array_add (user_data, escape_object_path (name));
+
+  return FALSE;
 }
 
 static gchar **
@@ -343,27 +1222,21 @@ shim_units_enumerate (GDBusConnection *connection,
                       const gchar     *object_path,
                       gpointer         user_data)
 {
-  gchar **cgroups;
-  guint i;
+  GPtrArray *nodes;
 
   had_activity ();
 
-  cgroups = state_list_units ();
+  nodes = g_ptr_array_new ();
+  unit_foreach (shim_units_enumerate_add, nodes);
+  g_ptr_array_add (nodes, NULL);
 
-  for (i = 0; cgroups[i]; i++)
-    {
-      gchar *unescaped;
-
-      unescaped = cgroups[i];
-      cgroups[i] = escape_object_path (unescaped);
-      g_free (unescaped);
-    }
-
-  return cgroups;
+  return (gchar **) g_ptr_array_free (nodes, FALSE);
 }
 
+static GDBusNodeInfo* shim_node;
 static GDBusInterfaceInfo* shim_units_iface;
 static GDBusInterfaceInfo* shim_scope_iface;
+static GDBusInterfaceInfo* shim_ntp_iface;
 
 static GDBusInterfaceInfo **
 shim_units_introspect (GDBusConnection *connection,
@@ -374,10 +1247,28 @@ shim_units_introspect (GDBusConnection *connection,
 {
   GDBusInterfaceInfo *result[] = { g_dbus_interface_info_ref (shim_units_iface),
                                    g_dbus_interface_info_ref (shim_scope_iface),
-                                   NULL };
+                                   NULL, NULL };
+  guint64 estimated_error, max_error;
+  gboolean synchronized;
+  Unit *unit = NULL;
 
   had_activity ();
 
+  if (node)
+    {
+      gchar *unit_name;
+
+      unit_name = unescape_object_path (node);
+      unit = lookup_unit (unit_name, NULL);
+      g_free (unit_name);
+    }
+
+  if (unit && ntp_unit_get_sync_status (unit, &synchronized, &estimated_error, &max_error))
+    result[2] = g_dbus_interface_info_ref (shim_ntp_iface);
+
+  if (unit)
+    g_object_unref (unit);
+
   return g_memdup (result, sizeof result);
 }
 
@@ -391,49 +1282,114 @@ shim_units_dispatch (GDBusConnection *connection,
                      gpointer         user_data)
 {
   static const GDBusInterfaceVTable vtable = {
-    shim_unit_method_call,
+    shim_unit_method_call_queued,
     shim_unit_get_property
   };
+  static const GDBusInterfaceVTable ntp_vtable = {
+    NULL,
+    shim_ntp_get_property
+  };
 
   had_activity ();
 
   *out_user_data = (gpointer) node;
 
+  if (g_strcmp0 (interface_name, "com.ubuntu.SystemdShim.NTP") == 0)
+    return &ntp_vtable;
+
   return &vtable;
 }
 
+/* Exports our objects on 'connection', which is either the system bus
+ * or a peer connection to the private socket.
+ */
 static void
-shim_bus_acquired (GDBusConnection *connection,
-                   const gchar     *name,
-                   gpointer         user_data)
+shim_register_objects (GDBusConnection *connection)
 {
   GDBusInterfaceVTable vtable = {
-    shim_method_call,
+    shim_method_call_queued,
     shim_get_property,
   };
+  GDBusInterfaceVTable daemon_vtable = {
+    shim_method_call_queued,
+    shim_daemon_get_property,
+  };
+  GDBusInterfaceVTable stats_vtable = {
+    shim_stats_method_call,
+  };
   GDBusSubtreeVTable sub_vtable = {
     shim_units_enumerate,
     shim_units_introspect,
     shim_units_dispatch
   };
   GDBusInterfaceInfo *iface;
-  GDBusNodeInfo *node;
 
-  node = g_dbus_node_info_new_for_xml (systemd_iface, NULL);
-  shim_scope_iface = g_dbus_node_info_lookup_interface (node, "org.freedesktop.systemd1.Scope");
+  iface = g_dbus_node_info_lookup_interface (shim_node, "org.freedesktop.systemd1.Manager");
+
+  g_dbus_connection_register_object (connection, "/org/freedesktop/systemd1", iface, &vtable, NULL, NULL, NULL);
+
+  iface = g_dbus_node_info_lookup_interface (shim_node, "com.ubuntu.SystemdShim");
+  g_dbus_connection_register_object (connection, "/org/freedesktop/systemd1", iface, &daemon_vtable, NULL, NULL, NULL);
+
+  iface = g_dbus_node_info_lookup_interface (shim_node, "com.ubuntu.SystemdShim.Stats");
+  g_dbus_connection_register_object (connection, "/org/freedesktop/systemd1", iface, &stats_vtable, NULL, NULL, NULL);
+  g_dbus_connection_register_subtree (connection, "/org/freedesktop/systemd1/unit", &sub_vtable,
+                                      G_DBUS_SUBTREE_FLAGS_DISPATCH_TO_UNENUMERATED_NODES, NULL, NULL, NULL);
+}
+
+static void
+shim_bus_acquired (GDBusConnection *connection,
+                   const gchar     *name,
+                   gpointer         user_data)
+{
+  shim_register_objects (connection);
+}
+
+static void
+shim_parse_introspection_data (void)
+{
+  shim_node = g_dbus_node_info_new_for_xml (systemd_iface, NULL);
+  g_assert (shim_node);
+
+  shim_scope_iface = g_dbus_node_info_lookup_interface (shim_node, "org.freedesktop.systemd1.Scope");
   g_assert (shim_scope_iface);
   g_dbus_interface_info_ref (shim_scope_iface);
-  shim_units_iface = g_dbus_node_info_lookup_interface (node, "org.freedesktop.systemd1.Unit");
+  shim_units_iface = g_dbus_node_info_lookup_interface (shim_node, "org.freedesktop.systemd1.Unit");
   g_assert (shim_units_iface);
   g_dbus_interface_info_ref (shim_units_iface);
+  shim_ntp_iface = g_dbus_node_info_lookup_interface (shim_node, "com.ubuntu.SystemdShim.NTP");
+  g_assert (shim_ntp_iface);
+  g_dbus_interface_info_ref (shim_ntp_iface);
+}
 
-  iface = g_dbus_node_info_lookup_interface (node, "org.freedesktop.systemd1.Manager");
+static void
+shim_name_acquired (GDBusConnection *connection,
+                    const gchar     *name,
+                    gpointer         user_data)
+{
+  cold_start_usec = g_get_monotonic_time () - start_time;
+  SHIM_PROBE2 (activation_ready, activation_count, cold_start_usec);
+  g_debug ("Activation %" G_GUINT64_FORMAT ": acquired '%s' after %" G_GUINT64_FORMAT "us",
+           activation_count, name, cold_start_usec);
 
-  g_dbus_connection_register_object (connection, "/org/freedesktop/systemd1", iface, &vtable, NULL, NULL, NULL);
-  g_dbus_connection_register_subtree (connection, "/org/freedesktop/systemd1/unit", &sub_vtable,
-                                      G_DBUS_SUBTREE_FLAGS_DISPATCH_TO_UNENUMERATED_NODES, NULL, NULL, NULL);
+  if (private_socket)
+    {
+      GError *error = NULL;
+
+      if (!private_server_start (shim_register_objects, &error))
+        {
+          g_warning ("Unable to listen on " PRIVATE_SERVER_ADDRESS ": %s", error->message);
+          g_error_free (error);
+        }
+    }
+}
+
+static gboolean
+shim_preload_kexec (gpointer user_data)
+{
+  kexec_load_async (NULL, NULL);
 
-  g_dbus_node_info_unref (node);
+  return FALSE;
 }
 
 static void
@@ -448,16 +1404,81 @@ shim_name_lost (GDBusConnection *connection,
 int
 main (void)
 {
+  GDBusConnection *system_bus;
+
+  start_time = g_get_monotonic_time ();
+  request_rate_time = start_time;
+
+  idle_timeout_min = MAX (settings_get_int ("Daemon", "IdleTimeoutMinSec", 10), 1);
+  idle_timeout_max = MAX (settings_get_int ("Daemon", "IdleTimeoutMaxSec", 300), idle_timeout_min);
+  idle_busy_rate = MAX (settings_get_int ("Daemon", "IdleBusyRequests", 60), 1);
+  stay_resident = settings_get_boolean ("Daemon", "StayResident", FALSE);
+  private_socket = settings_get_boolean ("Daemon", "PrivateSocket", TRUE);
+
+  daemon_state_load ();
+  activation_count++;
+  daemon_state_save (FALSE);
+  stats_set_activation (activation_count, start_time);
+  SHIM_PROBE1 (activation_start, activation_count);
+
+  /* Everything here is arranged so that the slow parts overlap: the
+   * cgmanager setup runs in its own thread and the bus connection is
+   * established by the GDBus worker while we parse our introspection
+   * data.  Nothing is registered on the bus until the main loop runs,
+   * and we wait for the cgmanager thread to have moved us out of our
+   * cgroup before that.
+   */
+  cgmanager_init ();
+
   g_bus_own_name (G_BUS_TYPE_SYSTEM,
                   "org.freedesktop.systemd1",
                   G_BUS_NAME_OWNER_FLAGS_NONE,
                   shim_bus_acquired,
-                  NULL, /* name_acquired */
+                  shim_name_acquired,
                   shim_name_lost,
                   NULL, NULL);
 
-  cgmanager_move_self ();
+  shim_parse_introspection_data ();
+
+  unit_set_notify_func (shim_unit_state_changed);
+
+  /* If we went away during a suspend, don't leave anyone frozen.  This
+   * goes by what the state file says we froze, so it has to happen even
+   * if FreezeUserSlices has been turned off since; it only talks to
+   * cgmanager if there is anything to thaw.
+   */
+  cgroup_units_freeze_user_slices (FALSE);
+
+  /* Stage the kernel for a fast reboot, once we've dealt with whatever
+   * we were activated for.
+   */
+  if (settings_get_boolean ("Kexec", "Preload", FALSE))
+    g_idle_add_full (G_PRIORITY_LOW, shim_preload_kexec, NULL, NULL);
+
+  /* Make sure that we exit even if nobody ever talks to us */
+  schedule_exit_on_inactivity ();
+
+  main_loop = g_main_loop_new (NULL, FALSE);
+  g_unix_signal_add (SIGTERM, exit_on_signal, GINT_TO_POINTER (SIGTERM));
+  g_unix_signal_add (SIGINT, exit_on_signal, GINT_TO_POINTER (SIGINT));
+  g_unix_signal_add (SIGUSR1, dump_trace_on_signal, NULL);
+
+  cgmanager_wait_for_move ();
+
+  g_main_loop_run (main_loop);
+
+  /* Make sure that nothing we queued up is lost */
+  private_server_stop ();
+
+  system_bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, NULL);
+  if (system_bus)
+    {
+      g_dbus_connection_flush_sync (system_bus, NULL, NULL);
+      g_object_unref (system_bus);
+    }
+
+  update_request_rate (0);
+  daemon_state_save (TRUE);
 
-  while (1)
-    g_main_context_iteration (NULL, TRUE);
+  return 0;
 }
@@ -0,0 +1,142 @@
+/*
+ * Copyright © 2014 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#include "trace.h"
+
+#include <string.h>
+
+/* A fixed ring of the most recent requests.  Recording one is two clock
+ * reads and three bounded string copies into a preallocated slot; the
+ * names are truncated if they do not fit.
+ */
+#define TRACE_N_RECORDS 1024
+
+typedef struct
+{
+  gint64 real_time;
+  gint64 start;
+  gint64 duration;
+  gint64 phases[N_TRACE_PHASES];
+  gboolean failed;
+  gchar method_name[24];
+  gchar unit_name[72];
+  gchar sender[24];
+} TraceRecord;
+
+static const gchar * const trace_phase_names[] = {
+  [TRACE_PHASE_BACKEND] = "backend",
+  [TRACE_PHASE_STATE] = "state",
+  [TRACE_PHASE_SIGNAL] = "signal"
+};
+
+static TraceRecord trace_records[TRACE_N_RECORDS];
+static guint64 trace_n_recorded;
+static TraceRecord *trace_current;
+
+void
+trace_begin (const gchar *method_name,
+             const gchar *unit_name,
+             const gchar *sender)
+{
+  TraceRecord *record;
+
+  record = &trace_records[trace_n_recorded++ % TRACE_N_RECORDS];
+
+  record->real_time = g_get_real_time ();
+  record->start = g_get_monotonic_time ();
+  record->duration = -1;
+  memset (record->phases, 0, sizeof record->phases);
+  record->failed = FALSE;
+  g_strlcpy (record->method_name, method_name, sizeof record->method_name);
+  g_strlcpy (record->unit_name, unit_name ? unit_name : "-", sizeof record->unit_name);
+  g_strlcpy (record->sender, sender ? sender : "-", sizeof record->sender);
+
+  trace_current = record;
+}
+
+void
+trace_add_time (TracePhase phase,
+                gint64     usec)
+{
+  if (trace_current)
+    trace_current->phases[phase] += usec;
+}
+
+void
+trace_end (gboolean failed)
+{
+  if (!trace_current)
+    return;
+
+  trace_current->duration = g_get_monotonic_time () - trace_current->start;
+  trace_current->failed = failed;
+  trace_current = NULL;
+}
+
+gboolean
+trace_dump (const gchar  *filename,
+            GError      **error)
+{
+  gboolean success;
+  GString *dump;
+  guint phase;
+  guint64 i;
+
+  dump = g_string_new (NULL);
+  g_string_append_printf (dump, "# %" G_GUINT64_FORMAT " requests recorded, showing the last %u\n",
+                          trace_n_recorded, (guint) MIN (trace_n_recorded, TRACE_N_RECORDS));
+  g_string_append (dump, "# time method unit sender total_us");
+  for (phase = 0; phase < N_TRACE_PHASES; phase++)
+    g_string_append_printf (dump, " %s_us", trace_phase_names[phase]);
+  g_string_append (dump, " result\n");
+
+  i = trace_n_recorded > TRACE_N_RECORDS ? trace_n_recorded - TRACE_N_RECORDS : 0;
+  for (; i < trace_n_recorded; i++)
+    {
+      const TraceRecord *record = &trace_records[i % TRACE_N_RECORDS];
+      GDateTime *time;
+      gchar *formatted;
+
+      time = g_date_time_new_from_unix_local (record->real_time / G_TIME_SPAN_SECOND);
+      formatted = g_date_time_format (time, "%F %T");
+      g_string_append_printf (dump, "%s.%06d %s %s %s", formatted,
+                              (gint) (record->real_time % G_TIME_SPAN_SECOND),
+                              record->method_name, record->unit_name, record->sender);
+      g_date_time_unref (time);
+      g_free (formatted);
+
+      if (record->duration < 0)
+        g_string_append (dump, " -");
+      else
+        g_string_append_printf (dump, " %" G_GINT64_FORMAT, record->duration);
+
+      for (phase = 0; phase < N_TRACE_PHASES; phase++)
+        g_string_append_printf (dump, " %" G_GINT64_FORMAT, record->phases[phase]);
+
+      if (record->duration < 0)
+        g_string_append (dump, " in-progress\n");
+      else
+        g_string_append (dump, record->failed ? " failed\n" : " ok\n");
+    }
+
+  success = g_file_set_contents (filename, dump->str, dump->len, error);
+  g_string_free (dump, TRUE);
+
+  return success;
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright © 2014 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#ifndef _trace_h_
+#define _trace_h_
+
+#include <glib.h>
+
+#define TRACE_FILENAME "/run/systemd-shim-trace"
+
+typedef enum
+{
+  TRACE_PHASE_BACKEND,
+  TRACE_PHASE_STATE,
+  TRACE_PHASE_SIGNAL,
+  N_TRACE_PHASES
+} TracePhase;
+
+void trace_begin (const gchar *method_name,
+                  const gchar *unit_name,
+                  const gchar *sender);
+
+void trace_add_time (TracePhase phase,
+                     gint64     usec);
+
+void trace_end (gboolean failed);
+
+gboolean trace_dump (const gchar  *filename,
+                     GError      **error);
+
+#endif /* _trace_h_ */
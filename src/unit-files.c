@@ -0,0 +1,500 @@
+/*
+ * Copyright © 2014 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#include "unit-files.h"
+#include "probes.h"
+
+#include <string.h>
+#include <errno.h>
+#include <glib/gstdio.h>
+
+/* The state of the .service units that are backed by an init script or
+ * upstart job, as answered by GetUnitFileState and ListUnitFiles.
+ *
+ * The index is built in one pass over /etc/init.d, /etc/init and the
+ * rc?.d start links the first time it is needed.  It is thrown away
+ * when inotify reports a change in any of those directories, or on
+ * Reload, and rebuilt on the next query.
+ */
+static const gchar * const unit_files_rc_dirs[] = {
+  "/etc/rc2.d", "/etc/rc3.d", "/etc/rc4.d", "/etc/rc5.d"
+};
+
+typedef struct
+{
+  gchar *job;
+  gboolean upstart;
+  gboolean enabled;
+} UnitFile;
+
+static GTree *unit_files;
+static GPtrArray *unit_files_monitors;
+
+static void
+unit_file_free (gpointer data)
+{
+  UnitFile *file = data;
+
+  g_free (file->job);
+  g_slice_free (UnitFile, file);
+}
+
+static gint
+unit_files_name_compare (gconstpointer a,
+                         gconstpointer b,
+                         gpointer      user_data)
+{
+  return strcmp (a, b);
+}
+
+static void
+unit_files_invalidate (void)
+{
+  g_clear_pointer (&unit_files, g_tree_unref);
+}
+
+static void
+unit_files_changed (GFileMonitor      *monitor,
+                    GFile             *file,
+                    GFile             *other_file,
+                    GFileMonitorEvent  event_type,
+                    gpointer           user_data)
+{
+  unit_files_invalidate ();
+}
+
+static void
+unit_files_monitor (const gchar *path)
+{
+  GFileMonitor *monitor;
+  GFile *file;
+
+  file = g_file_new_for_path (path);
+  monitor = g_file_monitor_directory (file, G_FILE_MONITOR_NONE, NULL, NULL);
+  g_object_unref (file);
+
+  if (monitor)
+    {
+      g_signal_connect (monitor, "changed", G_CALLBACK (unit_files_changed), NULL);
+      g_ptr_array_add (unit_files_monitors, monitor);
+    }
+}
+
+static gboolean
+unit_files_upstart_is_manual (const gchar *job)
+{
+  gboolean manual = FALSE;
+  gchar *contents;
+  gchar *path;
+
+  path = g_strdup_printf ("/etc/init/%s.override", job);
+
+  if (g_file_get_contents (path, &contents, NULL, NULL))
+    {
+      gchar **lines;
+      guint i;
+
+      lines = g_strsplit (contents, "\n", 0);
+      for (i = 0; lines[i] && !manual; i++)
+        manual = g_str_equal (g_strstrip (lines[i]), "manual");
+
+      g_strfreev (lines);
+      g_free (contents);
+    }
+
+  g_free (path);
+
+  return manual;
+}
+
+/* Jobs with an S<two digits><job> link in any of the rc?.d directories */
+static GHashTable *
+unit_files_scan_start_links (void)
+{
+  GHashTable *started;
+  guint i;
+
+  started = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  for (i = 0; i < G_N_ELEMENTS (unit_files_rc_dirs); i++)
+    {
+      const gchar *name;
+      GDir *dir;
+
+      dir = g_dir_open (unit_files_rc_dirs[i], 0, NULL);
+      if (!dir)
+        continue;
+
+      while ((name = g_dir_read_name (dir)))
+        if (name[0] == 'S' && g_ascii_isdigit (name[1]) && g_ascii_isdigit (name[2]) && name[3])
+          g_hash_table_add (started, g_strdup (name + 3));
+
+      g_dir_close (dir);
+    }
+
+  return started;
+}
+
+static void
+unit_files_add (const gchar *job,
+                gboolean     upstart,
+                gboolean     enabled)
+{
+  UnitFile *file;
+
+  file = g_slice_new (UnitFile);
+  file->job = g_strdup (job);
+  file->upstart = upstart;
+  file->enabled = enabled;
+
+  g_tree_insert (unit_files, g_strconcat (job, ".service", NULL), file);
+}
+
+static void
+unit_files_ensure_loaded (void)
+{
+  GHashTable *started;
+  const gchar *name;
+  gint64 elapsed;
+  gint64 start;
+  GDir *dir;
+  guint i;
+
+  if (unit_files)
+    return;
+
+  /* Watch first, so that nothing slips in between the scan and the
+   * monitors being set up.
+   */
+  if (!unit_files_monitors)
+    {
+      unit_files_monitors = g_ptr_array_new_with_free_func (g_object_unref);
+      unit_files_monitor ("/etc/init.d");
+      unit_files_monitor ("/etc/init");
+      for (i = 0; i < G_N_ELEMENTS (unit_files_rc_dirs); i++)
+        unit_files_monitor (unit_files_rc_dirs[i]);
+    }
+
+  start = g_get_monotonic_time ();
+
+  unit_files = g_tree_new_full (unit_files_name_compare, NULL, g_free, unit_file_free);
+  started = unit_files_scan_start_links ();
+
+  if ((dir = g_dir_open ("/etc/init.d", 0, NULL)))
+    {
+      while ((name = g_dir_read_name (dir)))
+        {
+          gchar *path;
+
+          if (name[0] == '.' || g_str_equal (name, "rc") || g_str_equal (name, "rcS") ||
+              g_str_equal (name, "skeleton") || g_str_equal (name, "README"))
+            continue;
+
+          path = g_build_filename ("/etc/init.d", name, NULL);
+          if (g_file_test (path, G_FILE_TEST_IS_EXECUTABLE))
+            unit_files_add (name, FALSE, g_hash_table_contains (started, name));
+          g_free (path);
+        }
+
+      g_dir_close (dir);
+    }
+
+  /* Upstart jobs win over the compatibility init.d symlinks */
+  if ((dir = g_dir_open ("/etc/init", 0, NULL)))
+    {
+      while ((name = g_dir_read_name (dir)))
+        {
+          gchar *job;
+
+          if (name[0] == '.' || !g_str_has_suffix (name, ".conf"))
+            continue;
+
+          job = g_strndup (name, strlen (name) - strlen (".conf"));
+          unit_files_add (job, TRUE, !unit_files_upstart_is_manual (job));
+          g_free (job);
+        }
+
+      g_dir_close (dir);
+    }
+
+  g_hash_table_unref (started);
+
+  elapsed = g_get_monotonic_time () - start;
+  g_debug ("Indexed %d unit files in %" G_GINT64_FORMAT "us", g_tree_nnodes (unit_files), elapsed);
+  SHIM_PROBE2 (unit_files_loaded, g_tree_nnodes (unit_files), elapsed);
+}
+
+/* "enabled" or "disabled", or NULL for units that we don't have an init
+ * script or upstart job for.
+ */
+const gchar *
+unit_files_get_state (const gchar *name)
+{
+  UnitFile *file;
+
+  unit_files_ensure_loaded ();
+
+  file = g_tree_lookup (unit_files, name);
+
+  if (!file)
+    return NULL;
+
+  return file->enabled ? "enabled" : "disabled";
+}
+
+typedef struct
+{
+  UnitFilesForeachFunc func;
+  gpointer user_data;
+} UnitFilesForeach;
+
+static gboolean
+unit_files_foreach_one (gpointer key,
+                        gpointer value,
+                        gpointer user_data)
+{
+  UnitFilesForeach *foreach = user_data;
+  UnitFile *file = value;
+
+  return foreach->func (key, file->enabled ? "enabled" : "disabled", foreach->user_data);
+}
+
+/* Calls 'func' for each unit file, sorted by name */
+void
+unit_files_foreach (UnitFilesForeachFunc func,
+                    gpointer             user_data)
+{
+  UnitFilesForeach foreach = { func, user_data };
+
+  unit_files_ensure_loaded ();
+
+  g_tree_foreach (unit_files, unit_files_foreach_one, &foreach);
+}
+
+void
+unit_files_reload (void)
+{
+  unit_files_invalidate ();
+}
+
+/* Upstart has no links to add or remove: a job is disabled by a
+ * 'manual' stanza in its override file.
+ */
+static gboolean
+unit_files_upstart_set_enabled (const gchar  *job,
+                                gboolean      enabled,
+                                GError      **error)
+{
+  GString *result;
+  gchar *contents = NULL;
+  gboolean success;
+  gchar *path;
+
+  path = g_strdup_printf ("/etc/init/%s.override", job);
+  result = g_string_new (NULL);
+
+  if (g_file_get_contents (path, &contents, NULL, NULL))
+    {
+      gchar **lines;
+      guint i;
+
+      /* Keep everything but the 'manual' stanza */
+      lines = g_strsplit (contents, "\n", 0);
+      for (i = 0; lines[i]; i++)
+        {
+          gchar *stripped = g_strstrip (g_strdup (lines[i]));
+
+          if (!g_str_equal (stripped, "manual") && (lines[i][0] || lines[i + 1]))
+            g_string_append_printf (result, "%s\n", lines[i]);
+
+          g_free (stripped);
+        }
+
+      g_strfreev (lines);
+    }
+
+  if (!enabled)
+    g_string_append (result, "manual\n");
+
+  if (result->len)
+    success = g_file_set_contents (path, result->str, result->len, error);
+  else if (contents && g_unlink (path) != 0)
+    {
+      g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                   "Cannot remove %s: %s", path, g_strerror (errno));
+      success = FALSE;
+    }
+  else
+    success = TRUE;
+
+  g_string_free (result, TRUE);
+  g_free (contents);
+  g_free (path);
+
+  return success;
+}
+
+static void
+unit_files_rc_exited (GPid     pid,
+                      gint     status,
+                      gpointer user_data)
+{
+  GTask *task = user_data;
+  GError *error = NULL;
+
+  g_spawn_close_pid (pid);
+
+  /* Our own view is out of date either way */
+  unit_files_invalidate ();
+
+  if (g_spawn_check_exit_status (status, &error))
+    g_task_return_pointer (task, g_variant_ref (g_task_get_task_data (task)),
+                           (GDestroyNotify) g_variant_unref);
+  else
+    g_task_return_error (task, error);
+
+  g_object_unref (task);
+}
+
+/* Enables or disables several units in one go.  Upstart overrides are
+ * written straight away.  update-rc.d only takes one script at a time,
+ * so there is still one update-rc.d per init script, but they all run
+ * from a single shell that we spawn and wait for once per batch, rather
+ * than once per unit.  Names that are not in the index (our own units,
+ * for example) are skipped.
+ *
+ * If an override can't be written, the ones already written are put
+ * back and nothing else is done, so that a failed call changes nothing.
+ *
+ * The result is the list of changes, as EnableUnitFiles returns it.
+ */
+void
+unit_files_set_enabled_async (const gchar * const *names,
+                              gboolean             enabled,
+                              GAsyncReadyCallback  callback,
+                              gpointer             user_data)
+{
+  GVariantBuilder changes;
+  GError *error = NULL;
+  GPtrArray *written;
+  GPtrArray *argv;
+  GTask *task;
+  guint i;
+  GPid pid;
+
+  task = g_task_new (NULL, NULL, callback, user_data);
+
+  unit_files_ensure_loaded ();
+
+  argv = g_ptr_array_new ();
+  g_ptr_array_add (argv, "/bin/sh");
+  g_ptr_array_add (argv, "-c");
+  g_ptr_array_add (argv, "action=$1; shift; status=0; "
+                         "for job; do /usr/sbin/update-rc.d \"$job\" $action || status=1; done; "
+                         "exit $status");
+  g_ptr_array_add (argv, "sh");
+  g_ptr_array_add (argv, enabled ? "enable" : "disable");
+
+  g_variant_builder_init (&changes, G_VARIANT_TYPE ("a(sss)"));
+  written = g_ptr_array_new ();
+
+  for (i = 0; names[i]; i++)
+    {
+      UnitFile *file;
+
+      file = g_tree_lookup (unit_files, names[i]);
+
+      if (!file || file->enabled == enabled)
+        continue;
+
+      if (file->upstart)
+        {
+          gchar *path;
+
+          if (!unit_files_upstart_set_enabled (file->job, enabled, &error))
+            break;
+
+          g_ptr_array_add (written, file->job);
+
+          path = g_strdup_printf ("/etc/init/%s.override", file->job);
+          g_variant_builder_add (&changes, "(sss)", enabled ? "unlink" : "symlink", path, "");
+          g_free (path);
+        }
+      else
+        {
+          gchar *path;
+
+          g_ptr_array_add (argv, file->job);
+
+          path = g_strdup_printf ("/etc/init.d/%s", file->job);
+          g_variant_builder_add (&changes, "(sss)", enabled ? "symlink" : "unlink", path, "");
+          g_free (path);
+        }
+
+      SHIM_PROBE2 (unit_file_set_enabled, names[i], enabled);
+    }
+
+  g_task_set_task_data (task, g_variant_ref_sink (g_variant_builder_end (&changes)),
+                        (GDestroyNotify) g_variant_unref);
+
+  if (error)
+    {
+      for (i = 0; i < written->len; i++)
+        unit_files_upstart_set_enabled (g_ptr_array_index (written, i), !enabled, NULL);
+
+      unit_files_invalidate ();
+      g_task_return_error (task, error);
+      g_object_unref (task);
+    }
+
+  else if (argv->len > 5)
+    {
+      g_ptr_array_add (argv, NULL);
+
+      if (g_spawn_async (NULL, (gchar **) argv->pdata, NULL, G_SPAWN_DO_NOT_REAP_CHILD,
+                         NULL, NULL, &pid, &error))
+        g_child_watch_add (pid, unit_files_rc_exited, task);
+      else
+        {
+          unit_files_invalidate ();
+          g_task_return_error (task, error);
+          g_object_unref (task);
+        }
+    }
+
+  else
+    {
+      unit_files_invalidate ();
+      g_task_return_pointer (task, g_variant_ref (g_task_get_task_data (task)),
+                             (GDestroyNotify) g_variant_unref);
+      g_object_unref (task);
+    }
+
+  g_ptr_array_free (written, TRUE);
+  g_ptr_array_free (argv, TRUE);
+}
+
+GVariant *
+unit_files_set_enabled_finish (GAsyncResult  *result,
+                               GError       **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
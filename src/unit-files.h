@@ -0,0 +1,35 @@
+/*
+ * Copyright © 2014 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#ifndef _unit_files_h_
+#define _unit_files_h_
+
+#include <gio/gio.h>
+
+typedef gboolean (* UnitFilesForeachFunc) (const gchar *name, const gchar *state, gpointer user_data);
+
+const gchar *unit_files_get_state (const gchar *name);
+void unit_files_foreach (UnitFilesForeachFunc func, gpointer user_data);
+void unit_files_reload (void);
+
+void unit_files_set_enabled_async (const gchar * const *names, gboolean enabled,
+                                   GAsyncReadyCallback callback, gpointer user_data);
+GVariant *unit_files_set_enabled_finish (GAsyncResult *result, GError **error);
+
+#endif /* _unit_files_h_ */
@@ -19,21 +19,78 @@
 
 #include "unit.h"
 
+#include "state.h"
+
+#include <string.h>
+
 G_DEFINE_TYPE (Unit, unit, G_TYPE_OBJECT)
 
+static const gchar * const unit_active_state_names[] = {
+  [UNIT_INACTIVE] = "inactive",
+  [UNIT_ACTIVATING] = "activating",
+  [UNIT_ACTIVE] = "active",
+  [UNIT_DEACTIVATING] = "deactivating",
+  [UNIT_FAILED] = "failed"
+};
+
+/* The index of all units that we currently know something about.
+ * This is sorted by name so that ListUnits has a stable order and can
+ * be answered with a single in-order walk.
+ */
+static GTree *units;
+static gboolean units_loaded;
+static UnitNotifyFunc unit_notify_func;
+
+static void
+unit_finalize (GObject *object)
+{
+  Unit *unit = (Unit *) object;
+
+  g_free (unit->name);
+
+  G_OBJECT_CLASS (unit_parent_class)->finalize (object);
+}
+
 static void
 unit_init (Unit *unit)
 {
+  unit->active_state = UNIT_INACTIVE;
+  unit->sub_state = "dead";
 }
 
 static void
 unit_class_init (UnitClass *class)
 {
+  G_OBJECT_CLASS (class)->finalize = unit_finalize;
 }
 
-Unit *
-lookup_unit (const gchar  *unit_name,
-             GError      **error)
+static gint
+unit_name_compare (gconstpointer a,
+                   gconstpointer b,
+                   gpointer      user_data)
+{
+  return strcmp (a, b);
+}
+
+/* 'name' is normally the unit's own name, but may be an alias of it */
+static void
+unit_register_as (Unit        *unit,
+                  const gchar *name)
+{
+  if (!units)
+    units = g_tree_new_full (unit_name_compare, NULL, g_free, g_object_unref);
+
+  g_tree_insert (units, g_strdup (name), g_object_ref (unit));
+}
+
+static void
+unit_register (Unit *unit)
+{
+  unit_register_as (unit, unit->name);
+}
+
+static Unit *
+create_unit (const gchar *unit_name)
 {
   Unit *unit = NULL;
 
@@ -50,19 +107,159 @@ lookup_unit (const gchar  *unit_name,
   else if (g_str_equal (unit_name, "reboot.target"))
     unit = power_unit_new (POWER_REBOOT);
 
+  else if (g_str_equal (unit_name, "hybrid-sleep.target"))
+    unit = power_unit_new (POWER_HYBRID_SLEEP);
+
+  else if (g_str_equal (unit_name, "suspend-then-hibernate.target"))
+    unit = power_unit_new (POWER_SUSPEND_THEN_HIBERNATE);
+
+  else if (g_str_equal (unit_name, "kexec.target"))
+    unit = power_unit_new (POWER_KEXEC);
+
   else if (g_str_equal (unit_name, "shutdown.target") || g_str_equal (unit_name, "poweroff.target"))
     unit = power_unit_new (POWER_OFF);
 
   else if (g_str_has_suffix (unit_name, ".slice") || g_str_has_suffix (unit_name, ".scope"))
     unit = cgroup_unit_new (unit_name);
 
+  /* Any other service is bridged to its init script or upstart job */
+  if (!unit && g_str_has_suffix (unit_name, ".service"))
+    unit = service_unit_new (unit_name);
+
+  return unit;
+}
+
+Unit *
+lookup_unit (const gchar  *unit_name,
+             GError      **error)
+{
+  Unit *unit;
+
+  if (units && (unit = g_tree_lookup (units, unit_name)))
+    return g_object_ref (unit);
+
+  unit = create_unit (unit_name);
+
   if (unit == NULL)
-    g_set_error (error, G_DBUS_ERROR, G_DBUS_ERROR_FILE_NOT_FOUND,
-                 "Unknown unit: %s", unit_name);
+    {
+      g_set_error (error, G_DBUS_ERROR, G_DBUS_ERROR_FILE_NOT_FOUND,
+                   "Unknown unit: %s", unit_name);
+      return NULL;
+    }
+
+  /* An existing unit that answers to another name as well has already
+   * been loaded under its own name.  Anything else is new, whether or
+   * not its constructor named it.
+   */
+  if (!unit->name || g_str_equal (unit->name, unit_name))
+    {
+      if (!unit->name)
+        unit->name = g_strdup (unit_name);
+
+      if (UNIT_GET_CLASS (unit)->load)
+        UNIT_GET_CLASS (unit)->load (unit);
+    }
+
+  if (!UNIT_GET_CLASS (unit)->transient ||
+      (unit->active_state != UNIT_INACTIVE && unit->active_state != UNIT_FAILED))
+    unit_register_as (unit, unit_name);
 
   return unit;
 }
 
+static void
+units_ensure_loaded (void)
+{
+  /* Only units that cost nothing to load: the NTP units have to look
+   * at the system to find out their state, so they are loaded when
+   * somebody first asks for them, as systemd does.
+   */
+  const gchar * const static_units[] = {
+    "hibernate.target", "hybrid-sleep.target", "kexec.target", "poweroff.target", "reboot.target",
+    "shutdown.target", "suspend.target", "suspend-then-hibernate.target"
+  };
+  gchar **recorded;
+  guint i;
+
+  if (units_loaded)
+    return;
+
+  units_loaded = TRUE;
+
+  for (i = 0; i < G_N_ELEMENTS (static_units); i++)
+    {
+      Unit *unit;
+
+      unit = lookup_unit (static_units[i], NULL);
+      if (unit)
+        g_object_unref (unit);
+    }
+
+  /* The scopes and slices we were running before we last exited.  They
+   * were active then, so list them even if lookup_unit() ends up
+   * loading one as inactive: it will drop out of the index as soon as
+   * it is stopped or abandoned.
+   */
+  recorded = state_list_units ();
+  for (i = 0; recorded[i]; i++)
+    {
+      Unit *unit;
+
+      unit = lookup_unit (recorded[i], NULL);
+
+      if (!unit)
+        continue;
+
+      if (!units || !g_tree_lookup (units, recorded[i]))
+        unit_register (unit);
+
+      g_object_unref (unit);
+    }
+  g_strfreev (recorded);
+}
+
+/* Returns a new reference to 'unit_name' if it is in the index, without
+ * trying to load it otherwise.
+ */
+Unit *
+unit_get_loaded (const gchar *unit_name)
+{
+  Unit *unit;
+
+  units_ensure_loaded ();
+
+  unit = units ? g_tree_lookup (units, unit_name) : NULL;
+
+  return unit ? g_object_ref (unit) : NULL;
+}
+
+/* Calls 'func' for each unit in the index, sorted by name.  'func' must
+ * not cause units to be added to or removed from the index.
+ */
+void
+unit_foreach (UnitForeachFunc func,
+              gpointer        user_data)
+{
+  units_ensure_loaded ();
+
+  if (units)
+    g_tree_foreach (units, (GTraverseFunc) func, user_data);
+}
+
+void
+unit_set_notify_func (UnitNotifyFunc func)
+{
+  unit_notify_func = func;
+}
+
+const gchar *
+unit_get_name (Unit *unit)
+{
+  g_return_val_if_fail (unit != NULL, NULL);
+
+  return unit->name;
+}
+
 const gchar *
 unit_get_state (Unit *unit)
 {
@@ -71,24 +268,168 @@ unit_get_state (Unit *unit)
   return UNIT_GET_CLASS (unit)->get_state (unit);
 }
 
+const gchar *
+unit_get_active_state (Unit *unit)
+{
+  g_return_val_if_fail (unit != NULL, NULL);
+
+  return unit_active_state_names[unit->active_state];
+}
+
+const gchar *
+unit_get_sub_state (Unit *unit)
+{
+  g_return_val_if_fail (unit != NULL, NULL);
+
+  return unit->sub_state;
+}
+
+/* The 'result' to report in JobRemoved for a job that just finished */
+const gchar *
+unit_get_job_result (Unit *unit)
+{
+  g_return_val_if_fail (unit != NULL, NULL);
+
+  return unit->active_state == UNIT_FAILED ? "failed" : "done";
+}
+
+gchar *
+unit_get_control_group (Unit *unit)
+{
+  g_return_val_if_fail (unit != NULL, NULL);
+
+  if (!UNIT_GET_CLASS (unit)->get_control_group)
+    return NULL;
+
+  return UNIT_GET_CLASS (unit)->get_control_group (unit);
+}
+
+void
+unit_set_active_state (Unit            *unit,
+                       UnitActiveState  state,
+                       const gchar     *sub_state)
+{
+  gboolean was_active, is_active;
+  gboolean was_inactive, is_inactive;
+  guint64 now;
+
+  g_return_if_fail (unit != NULL);
+
+  if (unit->active_state == state && g_strcmp0 (unit->sub_state, sub_state) == 0)
+    return;
+
+  now = g_get_real_time ();
+
+  was_active = unit->active_state == UNIT_ACTIVE;
+  is_active = state == UNIT_ACTIVE;
+  was_inactive = unit->active_state == UNIT_INACTIVE || unit->active_state == UNIT_FAILED;
+  is_inactive = state == UNIT_INACTIVE || state == UNIT_FAILED;
+
+  if (was_inactive && !is_inactive)
+    unit->inactive_exit_timestamp = now;
+  if (!was_active && is_active)
+    unit->active_enter_timestamp = now;
+  if (was_active && !is_active)
+    unit->active_exit_timestamp = now;
+  if (!was_inactive && is_inactive)
+    unit->inactive_enter_timestamp = now;
+
+  g_debug ("%s: %s (%s) -> %s (%s)", unit->name,
+           unit_active_state_names[unit->active_state], unit->sub_state,
+           unit_active_state_names[state], sub_state);
+
+  unit->active_state = state;
+  unit->sub_state = sub_state;
+  unit->state_change_timestamp = now;
+
+  if (unit_notify_func)
+    unit_notify_func (unit);
+
+  /* Keep track of the unit while it is doing something interesting */
+  if (UNIT_GET_CLASS (unit)->transient && is_inactive)
+    {
+      if (units && g_tree_lookup (units, unit->name) == unit)
+        g_tree_remove (units, unit->name);
+    }
+  else if (!units || !g_tree_lookup (units, unit->name))
+    unit_register (unit);
+}
+
 void
 unit_start (Unit *unit)
 {
   g_return_if_fail (unit != NULL);
 
+  if (!UNIT_GET_CLASS (unit)->start)
+    {
+      unit_start_async (unit, NULL, NULL);
+      return;
+    }
+
   return UNIT_GET_CLASS (unit)->start (unit);
 }
 
+/* Completes once the unit has finished starting, successfully or not:
+ * check unit_get_job_result() for which.
+ */
 void
+unit_start_async (Unit                *unit,
+                  GAsyncReadyCallback  callback,
+                  gpointer             user_data)
+{
+  GTask *task;
+
+  g_return_if_fail (unit != NULL);
+
+  task = g_task_new (unit, NULL, callback, user_data);
+
+  if (UNIT_GET_CLASS (unit)->start_async)
+    {
+      UNIT_GET_CLASS (unit)->start_async (unit, task);
+      return;
+    }
+
+  UNIT_GET_CLASS (unit)->start (unit);
+  g_task_return_boolean (task, TRUE);
+  g_object_unref (task);
+}
+
+gboolean
+unit_start_finish (Unit          *unit,
+                   GAsyncResult  *result,
+                   GError       **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, unit), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+gboolean
+unit_is_disruptive (Unit *unit)
+{
+  g_return_val_if_fail (unit != NULL, FALSE);
+
+  return UNIT_GET_CLASS (unit)->disruptive;
+}
+
+gboolean
+unit_is_transient (Unit *unit)
+{
+  g_return_val_if_fail (unit != NULL, FALSE);
+
+  return UNIT_GET_CLASS (unit)->transient;
+}
+
+gboolean
 unit_start_transient (Unit     *unit,
                       GVariant *properties)
 {
-  g_return_if_fail (unit != NULL);
+  g_return_val_if_fail (unit != NULL, FALSE);
 
   if (!UNIT_GET_CLASS (unit)->start_transient)
     {
       g_warning ("%s does not implement StartTransient", G_OBJECT_TYPE_NAME (unit));
-      return;
+      return FALSE;
     }
 
   return UNIT_GET_CLASS (unit)->start_transient (unit, properties);
@@ -99,17 +440,134 @@ unit_stop (Unit *unit)
 {
   g_return_if_fail (unit != NULL);
 
+  if (!UNIT_GET_CLASS (unit)->stop)
+    {
+      unit_stop_async (unit, NULL, NULL);
+      return;
+    }
+
   return UNIT_GET_CLASS (unit)->stop (unit);
 }
 
+/* Stop jobs that are still running, whether or not anybody waits for
+ * them: we must not exit underneath one.
+ */
+static guint unit_stop_jobs;
+
+static void
+unit_stop_done (GObject      *source_object,
+                GAsyncResult *result,
+                gpointer      user_data)
+{
+  GTask *task = user_data;
+  GError *error = NULL;
+
+  unit_stop_jobs--;
+
+  if (g_task_propagate_boolean (G_TASK (result), &error))
+    g_task_return_boolean (task, TRUE);
+  else
+    g_task_return_error (task, error);
+
+  g_object_unref (task);
+}
+
+void
+unit_stop_async (Unit                *unit,
+                 GAsyncReadyCallback  callback,
+                 gpointer             user_data)
+{
+  GTask *task;
+
+  g_return_if_fail (unit != NULL);
+
+  task = g_task_new (unit, NULL, callback, user_data);
+
+  if (UNIT_GET_CLASS (unit)->stop_async)
+    {
+      unit_stop_jobs++;
+      UNIT_GET_CLASS (unit)->stop_async (unit, g_task_new (unit, NULL, unit_stop_done, task));
+      return;
+    }
+
+  UNIT_GET_CLASS (unit)->stop (unit);
+  g_task_return_boolean (task, TRUE);
+  g_object_unref (task);
+}
+
+gboolean
+unit_stop_finish (Unit          *unit,
+                  GAsyncResult  *result,
+                  GError       **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, unit), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+gboolean
+unit_jobs_pending (void)
+{
+  return unit_stop_jobs > 0;
+}
+
+/* Stops all of 'units', handing those of a class that implements
+ * stop_many to it together.  Any changes to the state file are written
+ * out once, at the end.
+ */
+void
+unit_stop_many (Unit  **units,
+                guint   n_units)
+{
+  gboolean *handled;
+  GPtrArray *batch;
+  guint i, j;
+
+  handled = g_new0 (gboolean, n_units);
+  batch = g_ptr_array_new ();
+
+  state_freeze ();
+
+  for (i = 0; i < n_units; i++)
+    {
+      UnitClass *class;
+
+      if (handled[i])
+        continue;
+
+      class = UNIT_GET_CLASS (units[i]);
+
+      if (!class->stop_many)
+        {
+          unit_stop (units[i]);
+          continue;
+        }
+
+      for (j = i; j < n_units; j++)
+        if (!handled[j] && UNIT_GET_CLASS (units[j]) == class)
+          {
+            g_ptr_array_add (batch, units[j]);
+            handled[j] = TRUE;
+          }
+
+      class->stop_many ((Unit **) batch->pdata, batch->len);
+      g_ptr_array_set_size (batch, 0);
+    }
+
+  state_thaw ();
+
+  g_ptr_array_unref (batch);
+  g_free (handled);
+}
+
 void
 unit_abandon (Unit *unit)
 {
   g_return_if_fail (unit != NULL);
 
-  if (!UNIT_GET_CLASS (unit)->start_transient)
+  if (!UNIT_GET_CLASS (unit)->abandon)
     {
-      g_warning ("%s does not implement StartTransient", G_OBJECT_TYPE_NAME (unit));
+      g_warning ("%s does not implement Abandon", G_OBJECT_TYPE_NAME (unit));
       return;
     }
 
@@ -25,28 +25,103 @@
 #define UNIT_TYPE (unit_get_type ())
 #define UNIT_GET_CLASS(inst) (G_TYPE_INSTANCE_GET_CLASS ((inst), UNIT_TYPE, UnitClass))
 
-typedef GObject Unit;
+typedef enum
+{
+  UNIT_INACTIVE,
+  UNIT_ACTIVATING,
+  UNIT_ACTIVE,
+  UNIT_DEACTIVATING,
+  UNIT_FAILED
+} UnitActiveState;
+
+typedef struct
+{
+  GObject parent_instance;
+
+  gchar *name;
+  UnitActiveState active_state;
+  const gchar *sub_state;
+
+  /* CLOCK_REALTIME, in microseconds, as systemd does */
+  guint64 state_change_timestamp;
+  guint64 active_enter_timestamp;
+  guint64 active_exit_timestamp;
+  guint64 inactive_enter_timestamp;
+  guint64 inactive_exit_timestamp;
+} Unit;
 
 typedef struct
 {
   GObjectClass parent_class;
 
+  /* Units of a class with 'transient' set are forgotten about as soon
+   * as they become inactive again.
+   */
+  gboolean transient;
+
+  /* Starting a unit of a class with 'disruptive' set takes the system
+   * away (suspend, shutdown) so anything we have to say to our clients
+   * needs to go out first.
+   */
+  gboolean disruptive;
+
+  void (* load) (Unit *unit);
   const gchar * (* get_state) (Unit *unit);
+  gchar * (* get_control_group) (Unit *unit);
   void (* start) (Unit *unit);
-  void (* start_transient) (Unit *unit, GVariant *properties);
+
+  /* Optional: starts the unit and returns from 'task' once done.  Takes
+   * ownership of 'task'.
+   */
+  void (* start_async) (Unit *unit, GTask *task);
+
+  /* Returns FALSE, without starting anything, if the unit can't be
+   * started transiently with 'properties'.
+   */
+  gboolean (* start_transient) (Unit *unit, GVariant *properties);
   void (* stop) (Unit *unit);
+
+  /* Optional: stops the unit and returns from 'task' once done.  Takes
+   * ownership of 'task'.
+   */
+  void (* stop_async) (Unit *unit, GTask *task);
   void (* abandon) (Unit *unit);
+
+  /* Optional: stops several units of this class in one go */
+  void (* stop_many) (Unit **units, guint n_units);
 } UnitClass;
 
+typedef void (* UnitNotifyFunc) (Unit *unit);
+typedef gboolean (* UnitForeachFunc) (const gchar *name, Unit *unit, gpointer user_data);
+
 GType unit_get_type (void);
 Unit *lookup_unit (const gchar *name, GError **error);
+Unit *unit_get_loaded (const gchar *name);
+void unit_foreach (UnitForeachFunc func, gpointer user_data);
+void unit_set_notify_func (UnitNotifyFunc func);
+const gchar *unit_get_name (Unit *unit);
 const gchar *unit_get_state (Unit *unit);
-void unit_start_transient (Unit *unit, GVariant *properties);
+const gchar *unit_get_active_state (Unit *unit);
+const gchar *unit_get_sub_state (Unit *unit);
+const gchar *unit_get_job_result (Unit *unit);
+gchar *unit_get_control_group (Unit *unit);
+void unit_set_active_state (Unit *unit, UnitActiveState state, const gchar *sub_state);
+gboolean unit_start_transient (Unit *unit, GVariant *properties);
 void unit_start (Unit *unit);
+void unit_start_async (Unit *unit, GAsyncReadyCallback callback, gpointer user_data);
+gboolean unit_start_finish (Unit *unit, GAsyncResult *result, GError **error);
+gboolean unit_is_disruptive (Unit *unit);
+gboolean unit_is_transient (Unit *unit);
 void unit_stop (Unit *unit);
+void unit_stop_async (Unit *unit, GAsyncReadyCallback callback, gpointer user_data);
+gboolean unit_stop_finish (Unit *unit, GAsyncResult *result, GError **error);
+gboolean unit_jobs_pending (void);
+void unit_stop_many (Unit **units, guint n_units);
 void unit_abandon (Unit *unit);
 
 Unit *ntp_unit_get (void);
+gboolean ntp_unit_get_sync_status (Unit *unit, gboolean *synchronized,
+                                   guint64 *estimated_error, guint64 *max_error);
 
 typedef enum
 {
@@ -54,11 +129,17 @@ typedef enum
   POWER_REBOOT,
   POWER_SUSPEND,
   POWER_HIBERNATE,
+  POWER_HYBRID_SLEEP,
+  POWER_SUSPEND_THEN_HIBERNATE,
+  POWER_KEXEC,
   N_POWER_ACTIONS
 } PowerAction;
 
 Unit *power_unit_new (PowerAction action);
 
+Unit *service_unit_new (const gchar *name);
+
 Unit *cgroup_unit_new (const gchar *name);
+void cgroup_units_freeze_user_slices (gboolean frozen);
 
 #endif /* _unit_h_ */
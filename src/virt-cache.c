@@ -0,0 +1,136 @@
+/*
+ * Copyright © 2014 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#include "virt-cache.h"
+#include "virt.h"
+
+#define BOOT_ID_FILENAME "/proc/sys/kernel/random/boot_id"
+
+/* Virtualization can't change without a reboot, but probing for it
+ * means CPUID, reading DMI files and scanning the environment of init,
+ * and we get a fresh process on every activation.  So we probe once per
+ * boot and keep the result in /run, tagged with the boot ID.
+ *
+ * An empty string means "none".
+ */
+
+static gboolean virt_cache_loaded;
+static gchar *virt_vm;
+static gchar *virt_container;
+
+static void
+virt_cache_probe (const gchar *boot_id)
+{
+  const gchar *container_id;
+  const gchar *vm_id;
+  gint container_r;
+  gint vm_r;
+
+  container_r = detect_container (&container_id);
+  vm_r = detect_vm (&vm_id);
+
+  virt_container = g_strdup (container_r > 0 ? container_id : "");
+  virt_vm = g_strdup (vm_r > 0 ? vm_id : "");
+
+  /* Don't remember anything we failed to find out */
+  if (boot_id && container_r >= 0 && vm_r >= 0)
+    {
+      GKeyFile *key_file;
+      GError *error = NULL;
+      gchar *data;
+      gsize length;
+
+      key_file = g_key_file_new ();
+      g_key_file_set_string (key_file, "Virtualization", "BootID", boot_id);
+      g_key_file_set_string (key_file, "Virtualization", "VM", virt_vm);
+      g_key_file_set_string (key_file, "Virtualization", "Container", virt_container);
+      data = g_key_file_to_data (key_file, &length, NULL);
+
+      if (!g_file_set_contents (VIRT_CACHE_FILENAME, data, length, &error))
+        {
+          g_warning ("Unable to write " VIRT_CACHE_FILENAME ": %s", error->message);
+          g_error_free (error);
+        }
+
+      g_key_file_free (key_file);
+      g_free (data);
+    }
+}
+
+static void
+virt_cache_load (void)
+{
+  GKeyFile *key_file;
+  gchar *boot_id;
+
+  if (virt_cache_loaded)
+    return;
+
+  virt_cache_loaded = TRUE;
+
+  if (g_file_get_contents (BOOT_ID_FILENAME, &boot_id, NULL, NULL))
+    g_strstrip (boot_id);
+  else
+    boot_id = NULL;
+
+  key_file = g_key_file_new ();
+
+  if (boot_id && g_key_file_load_from_file (key_file, VIRT_CACHE_FILENAME, G_KEY_FILE_NONE, NULL))
+    {
+      gchar *cached_boot_id;
+
+      cached_boot_id = g_key_file_get_string (key_file, "Virtualization", "BootID", NULL);
+
+      if (g_strcmp0 (cached_boot_id, boot_id) == 0)
+        {
+          virt_vm = g_key_file_get_string (key_file, "Virtualization", "VM", NULL);
+          virt_container = g_key_file_get_string (key_file, "Virtualization", "Container", NULL);
+        }
+
+      g_free (cached_boot_id);
+    }
+
+  g_key_file_free (key_file);
+
+  if (virt_vm == NULL || virt_container == NULL)
+    {
+      g_free (virt_vm);
+      g_free (virt_container);
+      virt_cache_probe (boot_id);
+    }
+
+  g_free (boot_id);
+}
+
+/* The same as detect_virtualization(): a container wins over a VM */
+const gchar *
+virt_cache_get_virtualization (void)
+{
+  virt_cache_load ();
+
+  return virt_container[0] ? virt_container : virt_vm;
+}
+
+const gchar *
+virt_cache_get_container (void)
+{
+  virt_cache_load ();
+
+  return virt_container;
+}
@@ -47,7 +47,10 @@ int detect_vm(const char **id) {
                 "Microsoft Corporation\0" "microsoft\0"
                 "innotek GmbH\0"          "oracle\0"
                 "Xen\0"                   "xen\0"
-                "Bochs\0"                 "bochs\0";
+                "Bochs\0"                 "bochs\0"
+                "KVM\0"                   "kvm\0"
+                "Parallels\0"             "parallels\0"
+                "Amazon EC2\0"            "amazon\0";
 
         static const char cpuid_vendor_table[] =
                 "XenVMMXenVMM\0"          "xen\0"
@@ -55,7 +58,10 @@ int detect_vm(const char **id) {
                 /* http://kb.vmware.com/selfservice/microsites/search.do?language=en_US&cmd=displayKC&externalId=1009458 */
                 "VMwareVMware\0"          "vmware\0"
                 /* http://msdn.microsoft.com/en-us/library/ff542428.aspx */
-                "Microsoft Hv\0"          "microsoft\0";
+                "Microsoft Hv\0"          "microsoft\0"
+                "TCGTCGTCGTCG\0"          "qemu\0"
+                "bhyve bhyve \0"          "bhyve\0"
+                " lrpepyh  vr\0"          "parallels\0";
 
         uint32_t eax, ecx;
         union {
@@ -153,6 +159,15 @@ int detect_vm(const char **id) {
 }
 
 int detect_container(const char **id) {
+
+        static const char container_table[] =
+                "lxc\0"
+                "lxc-libvirt\0"
+                "systemd-nspawn\0"
+                "docker\0"
+                "podman\0"
+                "rkt\0";
+
         FILE *f;
 
         /* Unfortunately many of these operations require root access
@@ -180,6 +195,14 @@ int detect_container(const char **id) {
                 return 1;
         }
 
+        if (access("/.dockerenv", F_OK) >= 0) {
+
+                if (id)
+                        *id = "docker";
+
+                return 1;
+        }
+
         f = fopen("/proc/1/environ", "re");
         if (f) {
                 bool done = false;
@@ -202,32 +225,19 @@ int detect_container(const char **id) {
                         }
                         line[i] = 0;
 
-                        if (streq(line, "container=lxc")) {
-                                fclose(f);
-
-                                if (id)
-                                        *id = "lxc";
-                                return 1;
+                        if (startswith(line, "container=")) {
+                                const char *j;
 
-                        } else if (streq(line, "container=lxc-libvirt")) {
                                 fclose(f);
 
-                                if (id)
-                                        *id = "lxc-libvirt";
-                                return 1;
-
-                        } else if (streq(line, "container=systemd-nspawn")) {
-                                fclose(f);
-
-                                if (id)
-                                        *id = "systemd-nspawn";
-                                return 1;
+                                if (id) {
+                                        *id = "other";
 
-                        } else if (startswith(line, "container=")) {
-                                fclose(f);
+                                        NULSTR_FOREACH(j, container_table)
+                                                if (streq(line + 10, j))
+                                                        *id = j;
+                                }
 
-                                if (id)
-                                        *id = "other";
                                 return 1;
                         }
 